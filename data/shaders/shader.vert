@@ -1,7 +1,10 @@
+// particle size and age (sec), streamed as half floats
+attribute vec2 sizeAge;
+
 void main() {
 
     gl_Position   = gl_ModelViewProjectionMatrix * gl_Vertex;
-	float size    = gl_Normal.x;
+	float size    = sizeAge.x;
     gl_PointSize  = size;
     gl_FrontColor = gl_Color;
 
@@ -155,6 +155,18 @@ public:
         return easyCam;
     }
 
+    // the camera of the current mode, for culling and level of detail
+    ofCamera& getCamera() {
+        switch (currentMode) {
+        case TRACKING_CAMERA:
+            return trackingCam;
+        case ONBOARD_CAMERA:
+            return onboardCam;
+        default:
+            return easyCam;
+        }
+    }
+
     CameraMode currentMode;
     glm::vec3 targetPosition;
 
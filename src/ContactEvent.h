@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ofMain.h"
+
+// Compact record of one body touching the terrain, produced by the
+// collision detection pass and consumed in order by the response,
+// effects/audio and HUD passes in ofApp::update.
+//
+struct ContactEvent {
+	int body;              // VehicleBatch slot of the body in contact
+	int numBoxes;          // terrain leaf boxes overlapping the body
+	glm::vec3 normal;      // average terrain normal at the contact points
+	glm::vec3 velocity;    // body velocity going into the contact
+	glm::vec3 impulse;     // response impulse, filled in by the response pass
+	bool crash;            // impulse too strong to survive, filled in by the response pass
+};
@@ -0,0 +1,195 @@
+#include "CurlNoise.h"
+#include "Rng.h"
+#include <fstream>
+
+// the sampler needs SSE2's integer lanes, which every x86-64 target has
+#if defined(PARTICLE_SIMD_AVX) || (defined(PARTICLE_SIMD_SSE) && (defined(__SSE2__) || defined(_M_X64)))
+#define CURL_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// Fill the field for "res" cells per side (rounded up to a power of two)
+// from "seed".  Each potential component is a sum of sine waves with
+// whole-number frequencies over the grid, so it tiles exactly.
+//
+void CurlNoiseField::generate(int r, uint64_t s) {
+	res = 1;
+	while (res < r) res <<= 1;
+	seed = s;
+	int cells = res * res * res;
+
+	// potential psi = (psi0, psi1, psi2), sampled on the grid
+	const int waves = 6;
+	Rng rng(seed);
+	vector<float> psi[3];
+	for (int c = 0; c < 3; c++) {
+		psi[c].assign(cells, 0);
+		for (int w = 0; w < waves; w++) {
+			// low frequencies only, so the flow stays smooth between cells
+			float kx = floor(rng.uniform(-3, 4)), ky = floor(rng.uniform(-3, 4)), kz = floor(rng.uniform(-3, 4));
+			float phase = rng.uniform(0, TWO_PI);
+			float amp = rng.uniform(0.5, 1);
+			float f = TWO_PI / res;
+			for (int z = 0; z < res; z++)
+				for (int y = 0; y < res; y++)
+					for (int x = 0; x < res; x++)
+						psi[c][(z * res + y) * res + x] += amp * sin(f * (kx * x + ky * y + kz * z) + phase);
+		}
+	}
+
+	// velocity = curl(psi), central differences wrapping at the edges
+	vx.resize(cells);
+	vy.resize(cells);
+	vz.resize(cells);
+	int m = res - 1;
+	auto at = [this](int x, int y, int z) { return (z * res + y) * res + x; };
+	double sum2 = 0;
+	for (int z = 0; z < res; z++) {
+		for (int y = 0; y < res; y++) {
+			for (int x = 0; x < res; x++) {
+				int xp = at((x + 1) & m, y, z), xm = at((x - 1) & m, y, z);
+				int yp = at(x, (y + 1) & m, z), ym = at(x, (y - 1) & m, z);
+				int zp = at(x, y, (z + 1) & m), zm = at(x, y, (z - 1) & m);
+				int i = at(x, y, z);
+				vx[i] = 0.5f * ((psi[2][yp] - psi[2][ym]) - (psi[1][zp] - psi[1][zm]));
+				vy[i] = 0.5f * ((psi[0][zp] - psi[0][zm]) - (psi[2][xp] - psi[2][xm]));
+				vz[i] = 0.5f * ((psi[1][xp] - psi[1][xm]) - (psi[0][yp] - psi[0][ym]));
+				sum2 += vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i];
+			}
+		}
+	}
+
+	// unit RMS speed, so force magnitudes mean the same for any seed
+	float norm = sum2 > 0 ? 1.0f / sqrt(sum2 / cells) : 0;
+	for (int i = 0; i < cells; i++) {
+		vx[i] *= norm;
+		vy[i] *= norm;
+		vz[i] *= norm;
+	}
+	pack();
+}
+
+/* Rebuild the packed 8-bit cells from vx, vy, vz */
+void CurlNoiseField::pack() {
+	int cells = (int)vx.size();
+	float peak = 0;
+	for (int i = 0; i < cells; i++) {
+		peak = std::max(peak, std::max(fabs(vx[i]), std::max(fabs(vy[i]), fabs(vz[i]))));
+	}
+	quantum = peak > 0 ? peak / 127 : 1;
+	float inv = 1.0f / quantum;
+	auto q = [inv](float v) { return (uint32_t)(uint8_t)(int8_t)lrintf(v * inv); };
+	packed.resize(cells);
+	for (int i = 0; i < cells; i++) {
+		packed[i] = q(vx[i]) | q(vy[i]) << 8 | q(vz[i]) << 16;
+	}
+}
+
+// Read a field written by save().  Fails, leaving the field untouched,
+// when the file is missing or was made for another size or seed.
+//
+bool CurlNoiseField::load(const string &path, int r, uint64_t s) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) return false;
+
+	char magic[4];
+	int fileRes;
+	uint64_t fileSeed;
+	file.read(magic, 4);
+	file.read((char *)&fileRes, sizeof(fileRes));
+	file.read((char *)&fileSeed, sizeof(fileSeed));
+	int want = 1;
+	while (want < r) want <<= 1;
+	if (!file || memcmp(magic, "CURL", 4) != 0 || fileRes != want || fileSeed != s) return false;
+
+	int cells = fileRes * fileRes * fileRes;
+	vector<float> x(cells), y(cells), z(cells);
+	file.read((char *)x.data(), cells * sizeof(float));
+	file.read((char *)y.data(), cells * sizeof(float));
+	file.read((char *)z.data(), cells * sizeof(float));
+	if (!file) return false;
+
+	res = fileRes;
+	seed = fileSeed;
+	vx.swap(x);
+	vy.swap(y);
+	vz.swap(z);
+	pack();
+	return true;
+}
+
+/* Write the field to disk for load() */
+bool CurlNoiseField::save(const string &path) const {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) return false;
+	int cells = res * res * res;
+	file.write("CURL", 4);
+	file.write((const char *)&res, sizeof(res));
+	file.write((const char *)&seed, sizeof(seed));
+	file.write((const char *)vx.data(), cells * sizeof(float));
+	file.write((const char *)vy.data(), cells * sizeof(float));
+	file.write((const char *)vz.data(), cells * sizeof(float));
+	return (bool)file;
+}
+
+/* Load the cached field at path, or generate it and cache it there */
+void CurlNoiseField::generateOrLoad(const string &path, int r, uint64_t s) {
+	if (!path.empty() && load(path, r, s)) return;
+	generate(r, s);
+	if (!path.empty() && !save(path)) {
+		cout << "Curl noise cache " << path << " could not be written" << endl;
+	}
+}
+
+// Add scale * velocity at the grid point nearest each of n points to
+// out.  The grid wraps, so any position is valid.
+//
+void CurlNoiseField::sample(const float *x, const float *y, const float *z, int n,
+	float scale, float *outX, float *outY, float *outZ) const {
+	const float inv = 1.0f / cellSize;
+	const int m = res - 1;
+	int shift = 0;
+	while ((1 << shift) < res) shift++;
+	const uint32_t *cells = packed.data();
+	const float step = scale * quantum;
+
+	// a whole number of tiles added before truncating makes every
+	// coordinate positive, so truncation rounds to the nearest point
+	// without a floor (good for 1024 tiles either way of the origin, to
+	// within 1/256 of a cell of the halfway point between two)
+	const float bias = res * 1024 + 0.5f;
+
+	int i = 0;
+#ifdef CURL_SIMD_SSE2
+	// grid indices for 4 particles in integer lanes, then one 32-bit
+	// fetch per particle, unpacked into x, y and z lanes
+	const __m128 vinv = _mm_set1_ps(inv), vbias = _mm_set1_ps(bias), vstep = _mm_set1_ps(step);
+	const __m128i vm = _mm_set1_epi32(m);
+	alignas(16) int idx[4];
+	for (; i + 4 <= n; i += 4) {
+		__m128i cx = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), vinv), vbias));
+		__m128i cy = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(y + i), vinv), vbias));
+		__m128i cz = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(z + i), vinv), vbias));
+		__m128i c = _mm_or_si128(_mm_and_si128(cx, vm),
+			_mm_or_si128(_mm_slli_epi32(_mm_and_si128(cy, vm), shift), _mm_slli_epi32(_mm_and_si128(cz, vm), 2 * shift)));
+		_mm_store_si128((__m128i *)idx, c);
+
+		__m128i v = _mm_set_epi32(cells[idx[3]], cells[idx[2]], cells[idx[1]], cells[idx[0]]);
+		__m128 vx4 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 24), 24));
+		__m128 vy4 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 24));
+		__m128 vz4 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 8), 24));
+		_mm_storeu_ps(outX + i, _mm_add_ps(_mm_loadu_ps(outX + i), _mm_mul_ps(vx4, vstep)));
+		_mm_storeu_ps(outY + i, _mm_add_ps(_mm_loadu_ps(outY + i), _mm_mul_ps(vy4, vstep)));
+		_mm_storeu_ps(outZ + i, _mm_add_ps(_mm_loadu_ps(outZ + i), _mm_mul_ps(vz4, vstep)));
+	}
+#endif
+	for (; i < n; i++) {
+		int cx = (int)(x[i] * inv + bias) & m;
+		int cy = (int)(y[i] * inv + bias) & m;
+		int cz = (int)(z[i] * inv + bias) & m;
+		uint32_t v = cells[cx | cy << shift | cz << 2 * shift];
+		outX[i] += step * (int8_t)(v & 0xff);
+		outY[i] += step * (int8_t)(v >> 8 & 0xff);
+		outZ[i] += step * (int8_t)(v >> 16 & 0xff);
+	}
+}
@@ -0,0 +1,390 @@
+#include "DebrisBatch.h"
+#include <unordered_map>
+
+// Shatter the meshes of a model into about "numPieces" pieces, in the
+// model's space scaled by "scale", as the lander is drawn
+//
+void DebrisBatch::shatter(ofxAssimpModelLoader &model, float scale, int numPieces) {
+	glm::mat4 S = glm::scale(glm::mat4(1.0), glm::vec3(scale, scale, scale));
+	vector<ofMesh> meshes;
+	for (int i = 0; i < model.getMeshCount(); i++) {
+		glm::mat4 M = S * model.getModelMatrix() * model.getMeshHelperTransform(i);
+		ofMesh mesh = model.getMesh(i);
+		for (glm::vec3 &v : mesh.getVertices()) v = glm::vec3(M * glm::vec4(v, 1));
+		meshes.push_back(mesh);
+	}
+	setPieces(meshes, numPieces);
+}
+
+// Split the triangles of "meshes" into pieces: triangles are binned by
+// their centers into a grid of cells, and the cells are shrunk until at
+// least numPieces of them are occupied.  Every occupied cell becomes one
+// piece.
+//
+void DebrisBatch::setPieces(const vector<ofMesh> &meshes, int numPieces) {
+	pieces.clear();
+
+	// every triangle, three corners each
+	vector<glm::vec3> corners;
+	for (const ofMesh &m : meshes) {
+		const vector<glm::vec3> &v = m.getVertices();
+		if (m.getNumIndices() > 0) {
+			const vector<ofIndexType> &idx = m.getIndices();
+			for (size_t k = 0; k + 2 < idx.size(); k += 3) {
+				corners.push_back(v[idx[k]]);
+				corners.push_back(v[idx[k + 1]]);
+				corners.push_back(v[idx[k + 2]]);
+			}
+		}
+		else {
+			for (size_t k = 0; k + 2 < v.size(); k += 3) {
+				corners.push_back(v[k]);
+				corners.push_back(v[k + 1]);
+				corners.push_back(v[k + 2]);
+			}
+		}
+	}
+	int numTris = (int)corners.size() / 3;
+	if (numTris == 0 || numPieces < 1) return;
+
+	vector<glm::vec3> centers(numTris);
+	glm::vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int t = 0; t < numTris; t++) {
+		centers[t] = (corners[3 * t] + corners[3 * t + 1] + corners[3 * t + 2]) * (1.0f / 3);
+		lo = glm::min(lo, centers[t]);
+		hi = glm::max(hi, centers[t]);
+	}
+
+	glm::vec3 extent = hi - lo;
+	float cell = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f));
+	vector<int> pieceOf(numTris);
+	std::unordered_map<int64_t, int> cells;
+	for (int pass = 0; pass < 32; pass++) {
+		cells.clear();
+		float inv = 1.0f / cell;
+		for (int t = 0; t < numTris; t++) {
+			int64_t ix = (int64_t)((centers[t].x - lo.x) * inv);
+			int64_t iy = (int64_t)((centers[t].y - lo.y) * inv);
+			int64_t iz = (int64_t)((centers[t].z - lo.z) * inv);
+			int64_t key = (ix << 42) | (iy << 21) | iz;
+			pieceOf[t] = cells.emplace(key, (int)cells.size()).first->second;
+		}
+		if ((int)cells.size() >= numPieces || (int)cells.size() == numTris) break;
+		cell *= 0.8f;
+	}
+
+	// piece centers, then the triangles around them with flat normals
+	pieces.resize(cells.size());
+	vector<int> tris(pieces.size(), 0);
+	for (DebrisPiece &p : pieces) {
+		p.center = glm::vec3(0, 0, 0);
+		p.radius = 0;
+	}
+	for (int t = 0; t < numTris; t++) {
+		pieces[pieceOf[t]].center += centers[t];
+		tris[pieceOf[t]]++;
+	}
+	for (int k = 0; k < (int)pieces.size(); k++) {
+		pieces[k].center = pieces[k].center * (1.0f / tris[k]);
+		pieces[k].mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+	}
+	for (int t = 0; t < numTris; t++) {
+		DebrisPiece &p = pieces[pieceOf[t]];
+		const glm::vec3 *c = &corners[3 * t];
+		glm::vec3 n = glm::cross(c[1] - c[0], c[2] - c[0]);
+		float len = glm::length(n);
+		n = len > 0 ? n * (1.0f / len) : glm::vec3(0, 1, 0);
+		for (int k = 0; k < 3; k++) {
+			glm::vec3 v = c[k] - p.center;
+			p.mesh.addVertex(v);
+			p.mesh.addNormal(n);
+			p.radius = std::max(p.radius, glm::length(v));
+		}
+	}
+}
+
+/* Allocate the pool arrays for "n" bodies, keeping live bodies that fit */
+void DebrisBatch::setCapacity(int n) {
+	forEachArray([n](vector<float> &a) { a.resize(n); });
+	piece.resize(n);
+	if (count > n) count = n;
+	numAsleep = 0;
+	for (int i = 0; i < count; i++) {
+		if (awake[i] == 0) numAsleep++;
+	}
+}
+
+// Bump "n" bodies into the free slots and return the first one.  When
+// the pool is full the oldest debris is dropped to make room.
+//
+int DebrisBatch::alloc(int n) {
+	if (capacity() == 0) setCapacity(1024);
+	int cap = capacity();
+	n = std::min(n, cap);
+	int over = count + n - cap;
+	if (over > 0) dropFront(over);
+	int first = count;
+	count += n;
+	return first;
+}
+
+// append the bodies, their sleep state and the random stream to a
+// snapshot.  The pieces come from the model at load time and are not
+// saved.
+//
+void DebrisBatch::saveState(SimSnapshot &snap) {
+	snap.put(count);
+	forEachArray([&snap, this](vector<float> &a) { snap.putData(a.data(), count); });
+	snap.putData(piece.data(), count);
+	snap.put(numAsleep);
+	snap.put(rng);
+}
+
+/* Read back the state written by saveState */
+void DebrisBatch::restoreState(SimSnapshot &snap) {
+	snap.get(count);
+	if (count > capacity()) setCapacity(count);
+	forEachArray([&snap, this](vector<float> &a) { snap.getData(a.data(), count); });
+	snap.getData(piece.data(), count);
+	snap.get(numAsleep);
+	snap.get(rng);
+}
+
+/* Remove the "n" oldest bodies (the front of the pool) */
+void DebrisBatch::dropFront(int n) {
+	for (int i = 0; i < n; i++) {
+		if (awake[i] == 0) numAsleep--;
+	}
+	int left = count - n;
+	forEachArray([n, left](vector<float> &a) {
+		memmove(a.data(), a.data() + n, left * sizeof(float));
+	});
+	memmove(piece.data(), piece.data() + n, left * sizeof(int));
+	count = left;
+}
+
+/* Remove all debris (capacity is kept) */
+void DebrisBatch::clear() {
+	count = 0;
+	numAsleep = 0;
+}
+
+// Throw one body per piece from a model at "pos", turned "rot" degrees
+// about the y axis like Shape::getTransform.  The bodies keep the model's
+// "velocity" and fly apart at around "speed", tumbling.  Return the
+// number of bodies thrown.
+//
+int DebrisBatch::explode(const glm::vec3 &pos, float rot, const glm::vec3 &velocity, float speed) {
+	int n = (int)pieces.size();
+	if (n == 0) return 0;
+	int first = alloc(n);
+	n = count - first;
+
+	float a = glm::radians(rot);
+	float c = cos(a), s = sin(a);
+	float spin = 6;    // rad/sec
+
+	for (int k = 0; k < n; k++) {
+		const DebrisPiece &p = pieces[k];
+		int i = first + k;
+
+		// piece center turned about y, as in the drawn model
+		glm::vec3 offset(c * p.center.x + s * p.center.z, p.center.y, -s * p.center.x + c * p.center.z);
+		px[i] = pos.x + offset.x;
+		py[i] = pos.y + offset.y;
+		pz[i] = pos.z + offset.z;
+
+		// outward from the model, a little upward, at a random fraction of speed
+		float len = glm::length(offset);
+		glm::vec3 dir = len > 0 ? offset * (1.0f / len) : glm::vec3(0, 1, 0);
+		float burst = speed * (0.5f + rng.uniform());
+		vx[i] = velocity.x + dir.x * burst;
+		vy[i] = velocity.y + dir.y * burst + speed * 0.5f * rng.uniform();
+		vz[i] = velocity.z + dir.z * burst;
+
+		qx[i] = 0;
+		qy[i] = sin(a / 2);
+		qz[i] = 0;
+		qw[i] = cos(a / 2);
+		wx[i] = rng.uniform(-spin, spin);
+		wy[i] = rng.uniform(-spin, spin);
+		wz[i] = rng.uniform(-spin, spin);
+
+		radius[i] = std::max(p.radius, 0.01f);
+		rest[i] = 0;
+		awake[i] = 1;
+		piece[i] = k;
+	}
+	return n;
+}
+
+// Advance the awake bodies by "dt" seconds: Euler step of the motion and
+// the tumbling, then terrain contact and sleep.  Sleeping slots get a
+// zero step, as in VehicleBatch, so the loops have no branches.
+//
+void DebrisBatch::update(float dt) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	contacts = 0;
+	if (dt <= 0 || count == numAsleep) {
+		updateMicros = 0;
+		return;
+	}
+	int n = count;
+
+	float *x = px.data(), *y = py.data(), *z = pz.data();
+	float *u = vx.data(), *v = vy.data(), *w = vz.data();
+	float *ax = qx.data(), *ay = qy.data(), *az = qz.data(), *aw = qw.data();
+	const float *ox = wx.data(), *oy = wy.data(), *oz = wz.data();
+	const float *on = awake.data();
+
+	/* Linear integration */
+	for (int i = 0; i < n; i++) {
+		float h = dt * on[i];
+		x[i] += u[i] * h;
+		y[i] += v[i] * h;
+		z[i] += w[i] * h;
+		v[i] += gravity * h;
+	}
+
+	/* Angular integration, q += dt / 2 * (omega, 0) q, then renormalize */
+	for (int i = 0; i < n; i++) {
+		float h = 0.5f * dt * on[i];
+		float dw = -(ox[i] * ax[i] + oy[i] * ay[i] + oz[i] * az[i]);
+		float dx = ox[i] * aw[i] + oy[i] * az[i] - oz[i] * ay[i];
+		float dy = oy[i] * aw[i] + oz[i] * ax[i] - ox[i] * az[i];
+		float dz = oz[i] * aw[i] + ox[i] * ay[i] - oy[i] * ax[i];
+		float qw1 = aw[i] + dw * h, qx1 = ax[i] + dx * h, qy1 = ay[i] + dy * h, qz1 = az[i] + dz * h;
+		float inv = 1.0f / sqrt(qw1 * qw1 + qx1 * qx1 + qy1 * qy1 + qz1 * qz1);
+		aw[i] = qw1 * inv;
+		ax[i] = qx1 * inv;
+		ay[i] = qy1 * inv;
+		az[i] = qz1 * inv;
+	}
+
+	/* Damping */
+	float d = damping;
+	for (int i = 0; i < n; i++) {
+		float di = 1.0f + (d - 1.0f) * on[i];
+		u[i] *= di;
+		v[i] *= di;
+		w[i] *= di;
+		wx[i] *= di;
+		wy[i] *= di;
+		wz[i] *= di;
+	}
+
+	contacts = collide(dt);
+	updateMicros = ofGetElapsedTimeMicros() - start;
+}
+
+// Push the awake bodies out of the terrain and bounce them, then put the
+// ones that have come to rest to sleep.  Each body is a sphere; the
+// terrain under it is the plane through the deepest terrain vertex
+// within its radius (at least probeRadius) horizontally.  Return the number of bodies touching.
+//
+int DebrisBatch::collide(float dt) {
+	if (terrain == nullptr) return 0;
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+	float maxR = probeRadius;
+	for (int i = 0; i < count; i++) {
+		if (awake[i] == 0) continue;
+		minX = std::min(minX, px[i]); maxX = std::max(maxX, px[i]);
+		minY = std::min(minY, py[i]); maxY = std::max(maxY, py[i]);
+		minZ = std::min(minZ, pz[i]); maxZ = std::max(maxZ, pz[i]);
+		maxR = std::max(maxR, radius[i]);
+	}
+
+	// bodies that fell off the terrain would fall forever
+	float floor = terrain->root.box.parameters[0].y();
+	for (int i = 0; i < count; i++) {
+		if (awake[i] != 0 && py[i] < floor - 100) {
+			awake[i] = 0;
+			numAsleep++;
+		}
+	}
+
+	if (!patch.gather(*terrain, minX - maxR, minY - maxR, minZ - maxR,
+		maxX + maxR, maxY + maxR, maxZ + maxR, maxR)) return 0;
+
+	const vector<glm::vec3> &verts = terrain->mesh.getVertices();
+	const vector<glm::vec3> &normals = terrain->mesh.getNormals();
+	int touching = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (awake[i] == 0) continue;
+		float r = radius[i];
+		float probe = std::max(r, probeRadius);
+		float r2 = probe * probe;
+		glm::vec3 c(px[i], py[i], pz[i]);
+
+		// deepest terrain plane under the sphere
+		float depth = r + contactSlop;
+		glm::vec3 n(0, 1, 0);
+		patch.forEachNear(c.x, c.z, [&](int idx) {
+			const glm::vec3 &p = verts[idx];
+			float dx = c.x - p.x, dz = c.z - p.z;
+			if (dx * dx + dz * dz > r2) return;
+			glm::vec3 pn = idx < (int)normals.size() ? normals[idx] : glm::vec3(0, 1, 0);
+			float dist = glm::dot(c - p, pn);
+			if (dist < depth) {
+				depth = dist;
+				n = pn;
+			}
+		});
+
+		// resting bodies hop within contactSlop of the terrain between
+		// bounces, they still count as touching
+		bool touch = depth < r + contactSlop;
+		if (touch) touching++;
+		if (depth < r) {
+			// out of the terrain
+			float push = r - depth;
+			px[i] += n.x * push;
+			py[i] += n.y * push;
+			pz[i] += n.z * push;
+
+			// reflect the normal part, slow the tangential part and the spin
+			float vn = vx[i] * n.x + vy[i] * n.y + vz[i] * n.z;
+			if (vn < 0) {
+				float tx = vx[i] - vn * n.x, ty = vy[i] - vn * n.y, tz = vz[i] - vn * n.z;
+				float keep = 1.0f - friction;
+				vx[i] = tx * keep - vn * restitution * n.x;
+				vy[i] = ty * keep - vn * restitution * n.y;
+				vz[i] = tz * keep - vn * restitution * n.z;
+				wx[i] *= keep;
+				wy[i] *= keep;
+				wz[i] *= keep;
+			}
+		}
+
+		// rest and sleep
+		float speed2 = vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i];
+		float spin2 = wx[i] * wx[i] + wy[i] * wy[i] + wz[i] * wz[i];
+		float slow2 = sleepSpeed * sleepSpeed;
+		rest[i] = touch && speed2 < slow2 && spin2 < 4 * slow2 ? rest[i] + dt : 0;
+		if (rest[i] >= sleepDelay) {
+			awake[i] = 0;
+			vx[i] = vy[i] = vz[i] = 0;
+			wx[i] = wy[i] = wz[i] = 0;
+			numAsleep++;
+		}
+	}
+	return touching;
+}
+
+/* Draw every body, its piece turned by its orientation */
+void DebrisBatch::draw() {
+	for (int i = 0; i < count; i++) {
+		ofPushMatrix();
+		ofTranslate(px[i], py[i], pz[i]);
+		float s = sqrt(std::max(0.0f, 1 - qw[i] * qw[i]));
+		if (s > 1e-4f) {
+			float angle = 2 * acos(std::min(1.0f, std::max(-1.0f, qw[i])));
+			ofRotate(ofRadToDeg(angle), qx[i] / s, qy[i] / s, qz[i] / s);
+		}
+		pieces[piece[i]].mesh.draw();
+		ofPopMatrix();
+	}
+}
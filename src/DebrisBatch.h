@@ -0,0 +1,94 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxAssimpModelLoader.h"
+#include "ParticleCollision.h"
+#include "Rng.h"
+#include "Snapshot.h"
+
+// one chunk of a shattered model, its triangles around its own center
+//
+struct DebrisPiece {
+	ofMesh mesh;          // triangles, relative to center
+	glm::vec3 center;     // center in model space
+	float radius;         // bounding sphere of the triangles
+};
+
+//  Rigid debris for crash explosions.  The model is shattered once into a
+//  few hundred pieces; each explosion throws one body per piece into the
+//  struct-of-arrays batch below.  To the terrain a body is a sphere: each
+//  step one octree traversal gathers the terrain under all awake bodies,
+//  and every body is pushed out of the vertices beneath it and bounces.
+//  A body that has been resting for sleepDelay falls asleep and costs
+//  nothing but its draw from then on.
+//
+//  The batch is a fixed-capacity pool like ParticleStore: when a new
+//  explosion does not fit, the oldest debris makes room.
+//
+class DebrisBatch {
+public:
+	void shatter(ofxAssimpModelLoader &model, float scale, int numPieces);
+	void setPieces(const vector<ofMesh> &meshes, int numPieces);
+	void setCapacity(int n);
+	int capacity() const { return (int)px.size(); }
+	int explode(const glm::vec3 &pos, float rot, const glm::vec3 &velocity, float speed);
+	void update(float dt);
+	void draw();
+	void clear();
+	void setSeed(uint64_t s) { rng.seed(s); }
+	int size() const { return count; }
+	int awakeCount() const { return count - numAsleep; }
+	void saveState(SimSnapshot &snap);
+	void restoreState(SimSnapshot &snap);
+
+	const Octree *terrain = nullptr;
+	vector<DebrisPiece> pieces;
+
+	// position and velocity
+	vector<float> px, py, pz;
+	vector<float> vx, vy, vz;
+
+	// orientation (unit quaternion) and angular velocity, rad/sec
+	vector<float> qx, qy, qz, qw;
+	vector<float> wx, wy, wz;
+
+	vector<float> radius;
+	vector<float> rest;       // sec spent resting on the terrain
+	vector<float> awake;      // 1 for awake slots, 0 for sleeping ones
+	vector<int> piece;        // index into pieces
+
+	int count = 0;            // bodies in use
+	int numAsleep = 0;
+
+	float gravity = -1.62f;
+	float damping = .995f;     // per step, linear and angular
+	float restitution = 0.3f;  // normal speed kept by a bounce
+	float friction = 0.4f;     // tangential and spin speed lost by a bounce
+	float sleepSpeed = 0.5f;   // slower than this counts as resting
+	float sleepDelay = 0.5f;   // sec of rest before falling asleep
+	float contactSlop = 0.05f; // gap to the terrain that still counts as contact
+	float probeRadius = 2.0f;  // least horizontal search radius for the terrain,
+	                           // so small pieces do not slip between vertices
+
+	int contacts = 0;            // bodies touching the terrain last step
+	uint64_t updateMicros = 0;   // time the last update took
+
+private:
+	int alloc(int n);
+	void dropFront(int n);
+	int collide(float dt);
+
+	Rng rng;
+	TerrainPatch patch;    // terrain under the awake bodies, refilled each step
+
+	// call f on every per-body float array
+	template <typename F> void forEachArray(F f) {
+		f(px); f(py); f(pz);
+		f(vx); f(vy); f(vz);
+		f(qx); f(qy); f(qz); f(qw);
+		f(wx); f(wy); f(wz);
+		f(radius);
+		f(rest);
+		f(awake);
+	}
+};
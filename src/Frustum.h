@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ofMain.h"
+#include "box.h"
+
+// objects drawn and culled by one kind of geometry in a frame
+//
+struct CullStats {
+	int drawn = 0;
+	int culled = 0;
+	void reset() { drawn = culled = 0; }
+};
+
+//  The six planes bounding a camera's view, pulled out of its combined
+//  view-projection matrix (Gribb & Hartmann).  A point is inside when it
+//  is on the positive side of every plane.  Boxes are classified against
+//  the planes so hierarchies can stop testing as soon as a node is fully
+//  outside or fully inside.
+//
+class Frustum {
+public:
+	typedef enum { Outside, Intersect, Inside } Side;
+
+	Frustum() {}
+	Frustum(const glm::mat4 &viewProjection) { set(viewProjection); }
+
+	/* Planes of the clip volume -w <= x, y, z <= w of "m" */
+	void set(const glm::mat4 &m) {
+		glm::vec4 row[4];
+		for (int i = 0; i < 4; i++) row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+		planes[0] = row[3] + row[0];   // left
+		planes[1] = row[3] - row[0];   // right
+		planes[2] = row[3] + row[1];   // bottom
+		planes[3] = row[3] - row[1];   // top
+		planes[4] = row[3] + row[2];   // near
+		planes[5] = row[3] - row[2];   // far
+	}
+
+	// the same frustum in the space that "m" maps to this one, so boxes
+	// in a model's own space can be tested without transforming them
+	//
+	Frustum transformed(const glm::mat4 &m) const {
+		Frustum f;
+		glm::mat4 t = glm::transpose(m);
+		for (int i = 0; i < 6; i++) f.planes[i] = t * planes[i];
+		return f;
+	}
+
+	// Where the box [min, max] is: for each plane only the corner
+	// farthest along its normal has to be tested for Outside, and the
+	// nearest corner for Inside
+	//
+	Side classify(const glm::vec3 &min, const glm::vec3 &max) const {
+		Side side = Inside;
+		for (int i = 0; i < 6; i++) {
+			const glm::vec4 &p = planes[i];
+			glm::vec3 far(p.x >= 0 ? max.x : min.x, p.y >= 0 ? max.y : min.y, p.z >= 0 ? max.z : min.z);
+			glm::vec3 near(p.x >= 0 ? min.x : max.x, p.y >= 0 ? min.y : max.y, p.z >= 0 ? min.z : max.z);
+			if (p.x * far.x + p.y * far.y + p.z * far.z + p.w < 0) return Outside;
+			if (p.x * near.x + p.y * near.y + p.z * near.z + p.w < 0) side = Intersect;
+		}
+		return side;
+	}
+
+	Side classify(const Box &box) const {
+		const Vector3 &a = box.parameters[0], &b = box.parameters[1];
+		return classify(glm::vec3(a.x(), a.y(), a.z()), glm::vec3(b.x(), b.y(), b.z()));
+	}
+
+	bool visible(const Box &box) const { return classify(box) != Outside; }
+
+	glm::vec4 planes[6];
+};
@@ -255,6 +255,21 @@ bool Octree::intersect(const Box &box, TreeNode & node, vector<Box> & boxListRtn
 	return intersection;
 }
 
+/* Collect every leaf overlapping box, without copying any nodes.  Leaves
+   are nodes without children, which also covers nodes at the depth limit
+   that still hold more than one point */
+void Octree::leavesInBox(const Box &box, const TreeNode & node, vector<const TreeNode *> & leavesRtn) const {
+	if (!node.box.overlap(box)) return;
+
+	if (node.children.empty()) {
+		leavesRtn.push_back(&node);
+		return;
+	}
+	for (const TreeNode &child : node.children) {
+		leavesInBox(box, child, leavesRtn);
+	}
+}
+
 void Octree::draw(TreeNode & node, int numLevels, int level, vector<ofColor> colors) {
 	// return if all levels have been drawn
 	if (level >= numLevels) {
@@ -273,6 +288,34 @@ void Octree::draw(TreeNode & node, int numLevels, int level, vector<ofColor> col
 	}
 }
 
+// Draw the levels like draw() above, but only the boxes the view can
+// see.  A box outside the frustum is skipped with its whole subtree; once
+// a box is fully inside, its subtree is drawn without further tests.
+// "stats" counts the boxes drawn and the subtrees culled.
+//
+void Octree::draw(const TreeNode & node, int numLevels, int level, const vector<ofColor> & colors,
+	const Frustum & frustum, CullStats & stats, bool inside) {
+	if (level >= numLevels) {
+		return;
+	}
+
+	if (!inside) {
+		Frustum::Side side = frustum.classify(node.box);
+		if (side == Frustum::Outside) {
+			stats.culled++;
+			return;
+		}
+		inside = side == Frustum::Inside;
+	}
+
+	ofSetColor(colors[level]);
+	drawBox(node.box);
+	stats.drawn++;
+	for (const TreeNode &child : node.children) {
+		draw(child, numLevels, level + 1, colors, frustum, stats, inside);
+	}
+}
+
 // Optional
 //
 void Octree::drawLeafNodes(TreeNode & node) {
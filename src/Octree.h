@@ -12,6 +12,7 @@
 #include "ofMain.h"
 #include "box.h"
 #include "ray.h"
+#include "Frustum.h"
 
 
 
@@ -29,10 +30,13 @@ public:
 	void subdivide(const ofMesh & mesh, TreeNode & node, int numLevels, int level);
 	bool intersect(const Ray &, const TreeNode & node, TreeNode & nodeRtn);
 	bool intersect(const Box &, TreeNode & node, vector<Box> & boxListRtn);
+	void leavesInBox(const Box &, const TreeNode & node, vector<const TreeNode *> & leavesRtn) const;
 	void draw(TreeNode & node, int numLevels, int level, vector<ofColor> colors);
 	void draw(int numLevels, int level, vector<ofColor> colors) {
 		draw(root, numLevels, level, colors);
 	}
+	void draw(const TreeNode & node, int numLevels, int level, const vector<ofColor> & colors,
+		const Frustum & frustum, CullStats & stats, bool inside = false);
 	void drawLeafNodes(TreeNode & node);
 	static void drawBox(const Box &box);
 	static Box meshBounds(const ofMesh &);
@@ -10,7 +10,7 @@ Particle::Particle() {
 	position.set(0, 0, 0);
 	forces.set(0, 0, 0);
 	lifespan = 5;
-	birthtime = 0;
+	elapsed = 0;
 	radius = .1;
 	damping = .99;
 	mass = 1;
@@ -50,12 +50,10 @@ void Particle::integrate() {
 	// clear forces on particle (they get re-added each step)
 	//
 	forces.set(0, 0, 0);
-}
 
-//  return age in seconds
-//
-float Particle::age() {
-	return (ofGetElapsedTimeMillis() - birthtime)/1000.0;
+	// particles age with the simulation, not the wall clock
+	//
+	elapsed += dt;
 }
 
 
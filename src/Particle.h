@@ -16,10 +16,10 @@ public:
 	float   mass;
 	float   lifespan;
 	float   radius;
-	float   birthtime;
+	float   elapsed;      // sec alive, advanced by integrate()
 	void    integrate();
 	void    draw();
-	float   age();        // sec
+	float   age() { return elapsed; }  // sec
 	ofColor color;
 };
 
@@ -0,0 +1,710 @@
+#include "ParticleBench.h"
+#include "ParticleStore.h"
+#include "ParticleSystem.h"
+#include "ParticleGrid.h"
+#include "Octree.h"
+#include "ParticleEmitter.h"
+#include "ThrustPlume.h"
+#include "ParticleSystemPool.h"
+#include "Player.h"
+#include "DebrisBatch.h"
+#include "ParticleSort.h"
+#include "TerrainLod.h"
+#include "WorkerPool.h"
+#include "Rng.h"
+#include <chrono>
+#include <fstream>
+
+// time "steps" calls of "step" and return nanoseconds per particle per step
+//
+template <typename F> static double nsPerParticle(int numParticles, int steps, F step) {
+	auto start = std::chrono::steady_clock::now();
+	for (int s = 0; s < steps; s++) step();
+	auto end = std::chrono::steady_clock::now();
+	double ns = std::chrono::duration<double, std::nano>(end - start).count();
+	return ns / ((double)numParticles * steps);
+}
+
+// compare the original per-particle integrate() against the struct-of-arrays
+// store, both with its scalar loop and its SIMD kernel
+//
+void benchParticleIntegrate(int numParticles, int steps) {
+	float dt = 1.0 / 60.0;
+
+	vector<Particle> aos;
+	ParticleStore soa;
+	soa.setCapacity(numParticles);
+	for (int i = 0; i < numParticles; i++) {
+		Particle p;
+		p.position.set(ofRandom(-10, 10), ofRandom(-10, 10), ofRandom(-10, 10));
+		p.velocity.set(ofRandom(-1, 1), ofRandom(-1, 1), ofRandom(-1, 1));
+		aos.push_back(p);
+		soa.add(p);
+	}
+
+	double aosNs = nsPerParticle(numParticles, steps, [&]() {
+		for (int i = 0; i < (int)aos.size(); i++) aos[i].integrate();
+	});
+	double scalarNs = nsPerParticle(numParticles, steps, [&]() {
+		soa.integrateScalar(dt);
+	});
+	double simdNs = nsPerParticle(numParticles, steps, [&]() {
+		soa.integrate(dt);
+	});
+
+	cout << "integrate " << numParticles << " particles: "
+		<< "Particle::integrate " << aosNs << " ns, "
+		<< "store scalar " << scalarNs << " ns, "
+		<< "store simd " << simdNs << " ns (per particle per step)" << endl;
+}
+
+// frame time when a whole burst of "numParticles" dies in the same frame,
+// removing them one at a time (the original erase loop) versus the single
+// compaction pass
+//
+void benchParticleExpiry(int numParticles) {
+	ParticleStore store;
+	store.setCapacity(numParticles);
+	Particle p;
+	p.lifespan = 1;
+	p.elapsed = 10;     // long expired
+	for (int i = 0; i < numParticles; i++) store.add(p);
+
+	// the erase loop runs on a copy so both start from the same burst
+	ParticleStore slow = store;
+	auto start = std::chrono::steady_clock::now();
+	int i = 0;
+	while (i < slow.size()) {
+		if (slow.lifespan[i] != -1 && slow.age[i] > slow.lifespan[i]) {
+			slow.remove(i);
+		}
+		else i++;
+	}
+	auto mid = std::chrono::steady_clock::now();
+	store.removeExpired();
+	auto end = std::chrono::steady_clock::now();
+
+	double eraseMs = std::chrono::duration<double, std::milli>(mid - start).count();
+	double compactMs = std::chrono::duration<double, std::milli>(end - mid).count();
+	cout << "expire " << numParticles << " particles in one frame: "
+		<< "erase loop " << eraseMs << " ms, "
+		<< "compaction " << compactMs << " ms" << endl;
+}
+
+// scaling of ParticleSystem::update (turbulence + gravity forces and
+// integration) from 1 thread to one per core.  With a fixed seed every
+// thread count must produce exactly the same particles.
+//
+void benchParticleThreads(int numParticles, int steps) {
+	WorkerPool &pool = WorkerPool::shared();
+	int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	auto turbulence = make_shared<TurbulenceForce>(ofVec3f(-20, -20, -20), ofVec3f(20, 20, 20));
+	auto gravity = make_shared<GravityForce>(ofVec3f(0, -1.62f, 0));
+
+	Particle p;
+	p.lifespan = -1;    // nothing expires during the run
+
+	vector<float> reference;
+	double baseMs = 0;
+	for (int threads = 1; threads <= maxThreads; threads++) {
+		pool.setNumThreads(threads);
+
+		ParticleSystem sys;
+		sys.addForce(turbulence);
+		sys.addForce(gravity);
+		sys.particles.setCapacity(numParticles);
+		sys.setSeed(1);
+		for (int i = 0; i < numParticles; i++) sys.add(p);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int s = 0; s < steps; s++) sys.update(1.0 / 60.0);
+		auto end = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(end - start).count() / steps;
+
+		// compare against the single-threaded run
+		bool same = true;
+		if (threads == 1) {
+			reference = sys.particles.x;
+			baseMs = ms;
+		}
+		else {
+			same = std::equal(reference.begin(), reference.begin() + numParticles, sys.particles.x.begin());
+		}
+
+		cout << "update " << numParticles << " particles on " << threads << " threads: "
+			<< ms << " ms per step, speedup " << baseMs / ms
+			<< (same ? "" : " (NOT deterministic)") << endl;
+	}
+
+	// back to one thread per core
+	pool.setNumThreads(0);
+}
+
+// cost of one random float from ofRandom, the scalar Rng and a batch fill
+//
+void benchRandom(int count) {
+	vector<float> out(count);
+	Rng rng(1);
+	RngLanes lanes(1);
+
+	double ofNs = nsPerParticle(count, 1, [&]() {
+		for (int i = 0; i < count; i++) out[i] = ofRandom(-1, 1);
+	});
+	double rngNs = nsPerParticle(count, 1, [&]() {
+		for (int i = 0; i < count; i++) out[i] = rng.uniform(-1, 1);
+	});
+	double fillNs = nsPerParticle(count, 1, [&]() {
+		lanes.fill(out.data(), count, -1, 1);
+	});
+
+	cout << "random " << count << " floats: "
+		<< "ofRandom " << ofNs << " ns, "
+		<< "Rng " << rngNs << " ns, "
+		<< "RngLanes::fill " << fillNs << " ns (per number)" << endl;
+}
+
+// spatial hash rebuild, and radius queries through the grid versus a
+// scan of every particle.  Particles fill a cube at a constant density of
+// one per unit volume, queries have the radius of one grid cell.
+//
+bool benchParticleGrid(int numParticles, int queries) {
+	Rng rng(1);
+	float side = cbrt((float)numParticles);
+	ParticleStore store;
+	store.setCapacity(numParticles);
+	Particle p;
+	for (int i = 0; i < numParticles; i++) {
+		p.position.set(rng.uniform(0, side), rng.uniform(0, side), rng.uniform(0, side));
+		store.add(p);
+	}
+
+	ParticleGrid grid;
+	double buildNs = nsPerParticle(numParticles, 20, [&]() { grid.build(store); });
+
+	vector<ofVec3f> points;
+	for (int q = 0; q < queries; q++) {
+		points.push_back(ofVec3f(rng.uniform(0, side), rng.uniform(0, side), rng.uniform(0, side)));
+	}
+
+	float radius = grid.cellSize;
+	int found = 0, scanned = 0;
+	double gridNs = nsPerParticle(queries, 1, [&]() {
+		for (const ofVec3f &pt : points) grid.forEachNear(pt, radius, [&found](int) { found++; });
+	});
+	double scanNs = nsPerParticle(queries, 1, [&]() {
+		float r2 = radius * radius;
+		for (const ofVec3f &pt : points) {
+			for (int i = 0; i < store.size(); i++) {
+				float dx = store.x[i] - pt.x, dy = store.y[i] - pt.y, dz = store.z[i] - pt.z;
+				if (dx * dx + dy * dy + dz * dz <= r2) scanned++;
+			}
+		}
+	});
+
+	cout << "grid " << numParticles << " particles: "
+		<< "rebuild " << buildNs * numParticles / 1e6 << " ms, "
+		<< "query " << gridNs / 1000 << " us vs scan " << scanNs / 1000 << " us"
+		<< (found == scanned ? "" : " MISMATCH") << endl;
+	return found == scanned;
+}
+
+// rolling "side" x "side" heightfield, one vertex per unit, two
+// triangles per square
+//
+static ofMesh heightfield(int side) {
+	ofMesh mesh;
+	for (int z = 0; z < side; z++) {
+		for (int x = 0; x < side; x++) {
+			mesh.addVertex(glm::vec3(x, 3 * sin(x * 0.1f) * cos(z * 0.1f), z));
+			mesh.addNormal(glm::vec3(0, 1, 0));
+		}
+	}
+	for (int z = 0; z + 1 < side; z++) {
+		for (int x = 0; x + 1 < side; x++) {
+			ofIndexType i = z * side + x;
+			mesh.addTriangle(i, i + side, i + 1);
+			mesh.addTriangle(i + 1, i + side, i + side + 1);
+		}
+	}
+	return mesh;
+}
+
+// cost of the terrain collision stage alone, for a burst of particles
+// raining onto a rolling 200 x 200 heightfield indexed by an octree
+//
+bool benchParticleCollision(int numParticles, int steps) {
+	float dt = 1.0 / 60.0;
+	Octree terrain;
+	terrain.create(heightfield(200), 20);
+
+	// a falling cloud, spawned together like an explosion
+	Rng rng(1);
+	ParticleStore store;
+	store.setCapacity(numParticles);
+	Particle p;
+	for (int i = 0; i < numParticles; i++) {
+		p.position.set(rng.uniform(90, 110), rng.uniform(0, 4), rng.uniform(90, 110));
+		p.velocity.set(rng.uniform(-2, 2), -30, rng.uniform(-2, 2));
+		store.add(p);
+	}
+
+	ParticleCollision collision;
+	collision.terrain = &terrain;
+	collision.probeRadius = 1;
+	int hits = 0;
+	ParticleStore world;
+	double ns = nsPerParticle(numParticles, steps, [&]() {
+		world = store;    // every step starts from the same cloud
+		hits = collision.collide(world, 0, world.size(), dt);
+	});
+
+	// the same cloud in a lander's frame (scaled, turned and moved, as
+	// Shape::getTransform builds it) must hit the same ground
+	glm::mat4 m = glm::translate(glm::mat4(1.0), glm::vec3(100, 5, 100));
+	m = glm::rotate(m, glm::radians(30.0f), glm::vec3(0, 1, 0));
+	m = glm::scale(m, glm::vec3(0.25f, 0.25f, 0.25f));
+	glm::mat4 inv = glm::inverse(m);
+	ParticleStore localStore = store;
+	for (int i = 0; i < localStore.size(); i++) {
+		glm::vec4 p = inv * glm::vec4(store.x[i], store.y[i], store.z[i], 1);
+		glm::vec4 v = inv * glm::vec4(store.vx[i], store.vy[i], store.vz[i], 0);
+		localStore.x[i] = p.x; localStore.y[i] = p.y; localStore.z[i] = p.z;
+		localStore.vx[i] = v.x; localStore.vy[i] = v.y; localStore.vz[i] = v.z;
+	}
+	collision.setTransform(m);
+	int localHits = 0;
+	ParticleStore local;
+	double localNs = nsPerParticle(numParticles, steps, [&]() {
+		local = localStore;
+		localHits = collision.collide(local, 0, local.size(), dt);
+	});
+
+	float error = 0;
+	for (int i = 0; i < local.size(); i++) {
+		glm::vec4 p = m * glm::vec4(local.x[i], local.y[i], local.z[i], 1);
+		glm::vec4 v = m * glm::vec4(local.vx[i], local.vy[i], local.vz[i], 0);
+		error = std::max(error, glm::length(glm::vec3(p) - glm::vec3(world.x[i], world.y[i], world.z[i])));
+		error = std::max(error, glm::length(glm::vec3(v) - glm::vec3(world.vx[i], world.vy[i], world.vz[i])));
+	}
+
+	bool same = localHits == hits && error < 1e-3f;
+	cout << "terrain collision " << numParticles << " particles: "
+		<< ns * 10000 / 1e6 << " ms per 10k, " << hits << " hits, "
+		<< "in a lander frame " << localNs * 10000 / 1e6 << " ms per 10k, " << localHits << " hits"
+		<< (same ? "" : " MISMATCH") << endl;
+	return same;
+}
+
+// fill a system with "n" particles in a cube, all from the same seed
+//
+static void fillSystem(ParticleSystem &sys, int n, uint64_t seed) {
+	Rng rng(seed);
+	sys.particles.setCapacity(n);
+	sys.particles.clear();
+	sys.setSeed(seed);
+	Particle p;
+	p.lifespan = -1;
+	for (int i = 0; i < n; i++) {
+		p.position.set(rng.uniform(-50, 50), rng.uniform(0, 100), rng.uniform(-50, 50));
+		p.velocity.set(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1));
+		sys.add(p);
+	}
+}
+
+// camera 100 units back from the origin looking down -z, at an angle
+//
+static glm::mat4 benchModelView() {
+	glm::mat4 mv;
+	mv[0] = glm::vec4(0.8f, 0, -0.6f, 0);
+	mv[1] = glm::vec4(0, 1, 0, 0);
+	mv[2] = glm::vec4(0.6f, 0, 0.8f, 0);
+	mv[3] = glm::vec4(0, 0, -100, 1);
+	return mv;
+}
+
+// back-to-front depth sort of a random cloud, checked for order
+//
+bool benchParticleSort(int numParticles, int reps) {
+	ParticleSystem sys;
+	fillSystem(sys, numParticles, 1);
+	glm::mat4 mv = benchModelView();
+	ParticleDepthSort sorter;
+	double ns = nsPerParticle(numParticles, reps, [&]() { sorter.sort(sys.particles, mv); });
+
+	// depths must not increase by more than one key step
+	const ParticleStore &ps = sys.particles;
+	bool sorted = true;
+	float prev = -FLT_MAX;
+	for (uint32_t i : sorter.order) {
+		float z = mv[0][2] * ps.x[i] + mv[1][2] * ps.y[i] + mv[2][2] * ps.z[i] + mv[3][2];
+		if (z < prev - 0.01f) sorted = false;
+		prev = std::max(prev, z);
+	}
+
+	cout << "depth sort " << numParticles << " particles: " << ns * numParticles / 1e6
+		<< " ms, " << ns << " ns per particle" << (sorted ? "" : " (NOT SORTED)") << endl;
+	return sorted;
+}
+
+// Frame cost of "crashes" simultaneous debris explosions over "steps"
+// frames, from the first bounce until the pieces have gone to sleep.  A
+// 10 x 3 cylinder of 800 triangles stands in for the lander model and
+// the crashes are spread over the 200 x 200 heightfield.
+//
+void benchDebris(int crashes, int steps) {
+	float dt = 1.0 / 60.0;
+	Octree terrain;
+	terrain.create(heightfield(200), 20);
+
+	ofMesh hull;
+	int segments = 40, rings = 10;
+	for (int r = 0; r < rings; r++) {
+		for (int s = 0; s < segments; s++) {
+			float a0 = TWO_PI * s / segments, a1 = TWO_PI * (s + 1) / segments;
+			glm::vec3 p00(3 * cos(a0), r, 3 * sin(a0)), p10(3 * cos(a1), r, 3 * sin(a1));
+			glm::vec3 p01(3 * cos(a0), r + 1, 3 * sin(a0)), p11(3 * cos(a1), r + 1, 3 * sin(a1));
+			hull.addVertex(p00); hull.addVertex(p10); hull.addVertex(p11);
+			hull.addVertex(p00); hull.addVertex(p11); hull.addVertex(p01);
+		}
+	}
+
+	DebrisBatch debris;
+	debris.setPieces(vector<ofMesh>(1, hull), 200);
+	debris.setCapacity((int)debris.pieces.size() * crashes);
+	debris.setSeed(1);
+	debris.terrain = &terrain;
+	for (int c = 0; c < crashes; c++) {
+		debris.explode(glm::vec3(40 + 40 * (c % 4), 20, 60 + 60 * (c / 4)), 30.0f * c, glm::vec3(0, -10, 0), 8);
+	}
+
+	double totalMs = 0, maxMs = 0;
+	int settled = -1;
+	for (int s = 0; s < steps; s++) {
+		auto start = std::chrono::steady_clock::now();
+		debris.update(dt);
+		auto end = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		totalMs += ms;
+		maxMs = std::max(maxMs, ms);
+		if (settled < 0 && debris.awakeCount() == 0) settled = s;
+	}
+
+	cout << "debris " << crashes << " crashes, " << debris.size() << " bodies: "
+		<< totalMs / steps << " ms per step, worst " << maxMs << " ms, ";
+	if (settled >= 0) cout << "all asleep after " << settled * dt << " sec" << endl;
+	else cout << debris.awakeCount() << " still awake" << endl;
+}
+
+// Level of detail on a "side" x "side" heightfield: build time, then
+// the chunks in view and the triangles drawn from a camera low over the
+// middle looking toward one edge and from high above the middle, with
+// and without a triangle budget
+//
+void benchTerrainLod(int side) {
+	TerrainLod terrain;
+	terrain.build(vector<ofMesh>(1, heightfield(side)), vector<ofMaterial>(), glm::mat4(1.0),
+		16, 6);
+
+	ofCamera cam;
+	cam.setFov(65.5);
+	struct { const char *name; glm::vec3 eye, target; } views[] = {
+		{ "close", glm::vec3(side / 2, 20, side / 2), glm::vec3(side / 2, 0, side / 4) },
+		{ "high", glm::vec3(side / 2, side, side / 2 + 1), glm::vec3(side / 2, 0, side / 2) },
+	};
+
+	cout << "terrain lod " << side << " x " << side << ": " << terrain.sourceTriangles << " triangles, "
+		<< terrain.chunks.size() << " chunks, " << terrain.levelCounts.size() << " levels, built in "
+		<< terrain.buildMillis << " ms" << endl;
+	for (auto &view : views) {
+		cam.setPosition(view.eye);
+		Frustum frustum(glm::perspective(glm::radians(65.5f), 16 / 9.0f, 0.1f, 10000.0f) *
+			glm::lookAt(view.eye, view.target, glm::vec3(0, 1, 0)));
+		terrain.maxTriangles = terrain.sourceTriangles;
+		terrain.select(cam, 1080, &frustum);
+		int unbounded = terrain.trianglesDrawn;
+		terrain.maxTriangles = terrain.sourceTriangles / 10;
+		terrain.select(cam, 1080, &frustum);
+		cout << "  " << view.name << ": " << terrain.cull.drawn << " chunks in view, " << terrain.cull.culled
+			<< " culled, " << unbounded << " triangles at " << terrain.maxPixelError << " px, "
+			<< terrain.trianglesDrawn << " under a budget of " << terrain.maxTriangles
+			<< ", select " << terrain.selectMicros << " us" << endl;
+	}
+}
+
+// Frame cost of a "seconds" long burn, the old way and the new way: a
+// one-shot burst of 1000 particles each time the engine is relit (once a
+// second here), against the plume emitting continuously at full
+// throttle.  Times are per frame; the plume should keep its worst frame
+// close to its mean once the ring has filled.
+//
+void benchThrust(float seconds) {
+	float dt = 1.0 / 60.0;
+	int frames = (int)(seconds / dt);
+	shared_ptr<GravityForce> gravity = make_shared<GravityForce>(ofVec3f(0, -1.62f, 0));
+
+	ParticleEmitter burst;
+	burst.sys->addForce(gravity);
+	burst.setEmitterType(DiskEmitter);
+	burst.setOneShot(true);
+	burst.setGroupSize(1000);
+	burst.setCapacity(4000);
+	burst.setSeed(2);
+
+	ThrustPlume plume;
+	plume.sys->addForce(gravity);
+	plume.setLifespan(3);
+	plume.setMaxRate(1000);
+	plume.setSeed(2);
+	plume.setThrottle(1);
+
+	int warm = (int)(plume.lifespan / dt);   // frames until the ring is full
+	double burstTotal = 0, burstWorst = 0, plumeTotal = 0, plumeWorst = 0;
+	int minLive = plume.ringSize(), maxLive = 0;
+	for (int f = 0; f < warm + frames; f++) {
+		if (f % 60 == 0) burst.start();
+		auto t0 = std::chrono::steady_clock::now();
+		burst.update(dt);
+		auto t1 = std::chrono::steady_clock::now();
+		plume.update(dt);
+		auto t2 = std::chrono::steady_clock::now();
+		if (f < warm) continue;
+
+		double b = std::chrono::duration<double, std::milli>(t1 - t0).count();
+		double p = std::chrono::duration<double, std::milli>(t2 - t1).count();
+		burstTotal += b;
+		burstWorst = std::max(burstWorst, b);
+		plumeTotal += p;
+		plumeWorst = std::max(plumeWorst, p);
+		minLive = std::min(minLive, plume.liveCount());
+		maxLive = std::max(maxLive, plume.liveCount());
+	}
+
+	cout << "thrust " << seconds << " sec burn: burst " << burstTotal / frames << " ms per frame, worst "
+		<< burstWorst << " ms; plume " << plumeTotal / frames << " ms per frame, worst " << plumeWorst
+		<< " ms, " << minLive << "-" << maxLive << " live" << endl;
+}
+
+// Memory held by the landers' particle effects over a long session.
+// Every cycle creates "vehicles" landers, fires both of their emitters
+// and destroys them again.  After the first cycle the system pool has
+// all the memory it needs, so the total must stay flat from then on.
+//
+bool benchVehicleMemory(int vehicles, int cycles) {
+	ParticleSystemPool &pool = ParticleSystemPool::shared();
+	size_t perVehicle = 0, warm = 0, bytes = 0;
+
+	for (int c = 0; c < cycles; c++) {
+		vector<unique_ptr<Player>> fleet;
+		perVehicle = 0;
+		for (int v = 0; v < vehicles; v++) {
+			fleet.push_back(unique_ptr<Player>(new Player()));
+			Player &player = *fleet.back();
+			player.emitter.spawnGroup();
+			player.thrust.setThrottle(1);
+			player.thrust.update(0.5f);
+			perVehicle += player.memoryBytes();
+		}
+		perVehicle /= vehicles;
+		fleet.clear();
+
+		bytes = pool.memoryBytes();
+		if (c == 0) warm = bytes;
+	}
+
+	cout << "vehicle memory: " << perVehicle << " bytes per vehicle, pool of "
+		<< pool.created() << " systems holds " << bytes << " bytes after "
+		<< cycles << " cycles of " << vehicles << " vehicles"
+		<< (bytes > warm ? " (GROWING)" : "") << endl;
+	return bytes <= warm;
+}
+
+// run every particle benchmark at the sizes of a thrust burst and an
+// explosion, return the number whose correctness check failed
+//
+int runParticleBenchmarks() {
+	cout << "Particle benchmarks" << endl;
+	int failed = 0;
+	benchParticleIntegrate(1000, 200);
+	benchParticleIntegrate(10000, 100);
+	benchParticleExpiry(10000);
+	benchParticleThreads(10000, 50);
+	benchRandom(1000000);
+	failed += !benchParticleGrid(1000, 1000);
+	failed += !benchParticleGrid(10000, 1000);
+	failed += !benchParticleGrid(100000, 1000);
+	failed += !benchParticleCollision(10000, 20);
+	failed += !benchParticleSort(10000, 100);
+	failed += !benchParticleSort(100000, 20);
+	benchDebris(1, 1200);
+	benchDebris(4, 1200);
+	benchDebris(8, 1200);
+	benchThrust(20);
+	benchTerrainLod(1000);
+	failed += !benchVehicleMemory(8, 100);
+	if (failed > 0) cout << failed << " particle benchmark checks FAILED" << endl;
+	return failed;
+}
+
+// the benchmarks that check their results, at one size each, return the
+// number that failed.  The vehicle memory check is left out: it builds
+// landers, whose shared forces read and write the data folder.
+//
+int runParticleChecks() {
+	int failed = 0;
+	failed += !benchParticleGrid(10000, 1000);
+	failed += !benchParticleCollision(10000, 20);
+	failed += !benchParticleSort(100000, 20);
+	return failed;
+}
+
+
+// one suite measurement: "reps" calls of "run", each preceded by an
+// untimed "prepare"
+//
+template <typename P, typename R> static ParticleBenchResult measure(const string &name,
+	int numParticles, int reps, P prepare, R run) {
+	double ns = 0;
+	for (int r = 0; r < reps; r++) {
+		prepare();
+		auto start = std::chrono::steady_clock::now();
+		run();
+		auto end = std::chrono::steady_clock::now();
+		ns += std::chrono::duration<double, std::nano>(end - start).count();
+	}
+	ParticleBenchResult result;
+	result.name = name;
+	result.particles = numParticles;
+	result.reps = reps;
+	result.nsPerParticle = ns / ((double)numParticles * reps);
+	result.msPerRep = ns / 1e6 / reps;
+	return result;
+}
+
+// Run the whole suite at 1k, 10k and 100k particles.  Repetitions shrink
+// with size so every measurement processes roughly the same number of
+// particles.
+//
+vector<ParticleBenchResult> runParticleSuite(uint64_t seed) {
+	vector<ParticleBenchResult> results;
+	float dt = 1.0 / 60.0;
+	int sizes[] = { 1000, 10000, 100000 };
+
+	const char *typeNames[] = { "directional", "radial", "sphere", "disk" };
+	EmitterType types[] = { DirectionalEmitter, RadialEmitter, SphereEmitter, DiskEmitter };
+
+	for (int n : sizes) {
+		int reps = std::max(5, 2000000 / n);
+
+		/* Spawn, one group of n per repetition */
+		for (int t = 0; t < 4; t++) {
+			ParticleEmitter emitter;
+			emitter.setEmitterType(types[t]);
+			emitter.setGroupSize(n);
+			emitter.setCapacity(n);
+			emitter.setSeed(seed);
+			emitter.radius = 10;
+			results.push_back(measure(string("spawn_") + typeNames[t], n, reps,
+				[&]() { emitter.sys->particles.clear(); },
+				[&]() { emitter.spawnGroup(); }));
+		}
+
+		/* Update with each built-in force, and with none */
+		struct { const char *name; shared_ptr<ParticleForce> force; } forces[] = {
+			{ "update_none", nullptr },
+			{ "update_gravity", make_shared<GravityForce>(ofVec3f(0, -1.62f, 0)) },
+			{ "update_turbulence", make_shared<TurbulenceForce>(ofVec3f(-20, -20, -20), ofVec3f(20, 20, 20)) },
+			{ "update_curl_noise", make_shared<CurlNoiseForce>(20) },
+			{ "update_impulse_radial", make_shared<ImpulseRadialForce>(100) },
+		};
+		for (auto &f : forces) {
+			ParticleSystem sys;
+			if (f.force) sys.addForce(f.force);
+			fillSystem(sys, n, seed);
+			results.push_back(measure(f.name, n, reps,
+				[&]() { sys.reset(); },
+				[&]() { sys.update(dt); }));
+		}
+
+		/* Mass expiry, the whole population dying in one frame */
+		ParticleSystem dying;
+		results.push_back(measure("expire_all", n, reps,
+			[&]() {
+				fillSystem(dying, n, seed);
+				std::fill(dying.particles.lifespan.begin(), dying.particles.lifespan.begin() + n, 1.0f);
+				std::fill(dying.particles.age.begin(), dying.particles.age.begin() + n, 2.0f);
+			},
+			[&]() { dying.particles.removeExpired(); }));
+
+		/* Back-to-front sort for alpha blending */
+		ParticleSystem cloud;
+		fillSystem(cloud, n, seed);
+		ParticleDepthSort sorter;
+		glm::mat4 mv = benchModelView();
+		results.push_back(measure("depth_sort", n, reps,
+			[]() {},
+			[&]() { sorter.sort(cloud.particles, mv); }));
+
+		/* Packing the vertex buffer */
+		ParticleSystem drawn;
+		fillSystem(drawn, n, seed);
+		vector<ParticleVertex> vertices(n);
+		results.push_back(measure("vbo_pack", n, reps,
+			[]() {},
+			[&]() { ParticleEmitter::packVertices(drawn.particles, 1, vertices.data()); }));
+	}
+	return results;
+}
+
+/* Write suite results as a JSON array of objects */
+void writeParticleSuiteJson(ostream &out, const vector<ParticleBenchResult> &results) {
+	out << "[" << endl;
+	for (int i = 0; i < (int)results.size(); i++) {
+		const ParticleBenchResult &r = results[i];
+		out << "  {\"name\": \"" << r.name << "\", \"particles\": " << r.particles
+			<< ", \"reps\": " << r.reps
+			<< ", \"ns_per_particle\": " << r.nsPerParticle
+			<< ", \"ms_per_rep\": " << r.msPerRep << "}"
+			<< (i + 1 < (int)results.size() ? "," : "") << endl;
+	}
+	out << "]" << endl;
+}
+
+/* Write suite results as CSV with a header row */
+void writeParticleSuiteCsv(ostream &out, const vector<ParticleBenchResult> &results) {
+	out << "name,particles,reps,ns_per_particle,ms_per_rep" << endl;
+	for (const ParticleBenchResult &r : results) {
+		out << r.name << "," << r.particles << "," << r.reps << ","
+			<< r.nsPerParticle << "," << r.msPerRep << endl;
+	}
+}
+
+// Headless entry point for "--bench [path]": run the suite with the fixed
+// seed and write JSON, or CSV when the path ends in ".csv".  Without a
+// path the JSON goes to stdout.  The result checks run too, reporting to
+// stderr.  Returns the process exit code, 1 when a check failed or the
+// results could not be written.
+//
+int runParticleSuiteMain(const string &path) {
+	vector<ParticleBenchResult> results = runParticleSuite(1);
+
+	// keep stdout for the results
+	std::streambuf *console = cout.rdbuf(cerr.rdbuf());
+	int failed = runParticleChecks();
+	cout.rdbuf(console);
+	if (failed > 0) cerr << failed << " particle benchmark checks FAILED" << endl;
+
+	bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+	if (path.empty()) {
+		writeParticleSuiteJson(cout, results);
+		return failed > 0 ? 1 : 0;
+	}
+	std::ofstream file(path);
+	if (!file) {
+		cerr << "cannot write benchmark results to " << path << endl;
+		return 1;
+	}
+	if (csv) writeParticleSuiteCsv(file, results);
+	else writeParticleSuiteJson(file, results);
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Particle performance measurements.  Results are printed to the console
+//  in nanoseconds per particle per step so runs of different sizes can be
+//  compared directly.  Benchmarks that also check their results return
+//  false, and flag the line, when the check fails.
+//
+void benchParticleIntegrate(int numParticles, int steps);
+void benchParticleExpiry(int numParticles);
+void benchParticleThreads(int numParticles, int steps);
+void benchRandom(int count);
+bool benchParticleGrid(int numParticles, int queries);
+bool benchParticleCollision(int numParticles, int steps);
+bool benchParticleSort(int numParticles, int reps);
+void benchDebris(int crashes, int steps);
+void benchThrust(float seconds);
+void benchTerrainLod(int side);
+bool benchVehicleMemory(int vehicles, int cycles);
+int runParticleBenchmarks();
+int runParticleChecks();
+
+//  Regression suite: the same measurements at fixed sizes and a fixed
+//  seed, collected as machine-readable results for tracking across
+//  changes.  Run headless with "--bench [results.json|results.csv]".
+//
+struct ParticleBenchResult {
+	string name;          // what was measured, e.g. "spawn_radial"
+	int particles;        // problem size
+	int reps;             // times it was repeated
+	double nsPerParticle; // mean cost per particle per repetition
+	double msPerRep;      // mean wall time per repetition
+};
+
+vector<ParticleBenchResult> runParticleSuite(uint64_t seed);
+void writeParticleSuiteJson(ostream &out, const vector<ParticleBenchResult> &results);
+void writeParticleSuiteCsv(ostream &out, const vector<ParticleBenchResult> &results);
+int runParticleSuiteMain(const string &path);
@@ -0,0 +1,72 @@
+#include "ParticleBudget.h"
+
+/* Put an emitter under the budget with the given priority */
+void ParticleBudget::add(ParticleEmitter *emitter, int priority) {
+	Entry e = { emitter, priority };
+	auto at = std::find_if(entries.begin(), entries.end(),
+		[priority](const Entry &o) { return o.priority < priority; });
+	entries.insert(at, e);
+}
+
+/* Take an emitter out of the budget, restoring its full spawn groups */
+void ParticleBudget::remove(ParticleEmitter *emitter) {
+	emitter->spawnScale = 1;
+	entries.erase(std::remove_if(entries.begin(), entries.end(),
+		[emitter](const Entry &o) { return o.emitter == emitter; }), entries.end());
+}
+
+/* Return live particles across every emitter */
+int ParticleBudget::total() const {
+	int n = 0;
+	for (const Entry &e : entries) n += e.emitter->liveCount();
+	return n;
+}
+
+// Call before the emitters update.  Work out this frame's particle limit
+// and scale each emitter's next spawn group to the room left for it.
+// Particles of lower priority effects do not count against higher ones;
+// they are culled in endFrame() if the higher ones need the room.
+//
+void ParticleBudget::beginFrame(float dt) {
+	startMicros = ofGetElapsedTimeMicros();
+
+	limit = maxParticles;
+	if (costMicros > 0) {
+		int affordable = (int)(budgetMicros / costMicros);
+		limit = std::max(minParticles, std::min(limit, affordable));
+	}
+
+	int used = 0;
+	for (Entry &e : entries) {
+		ParticleEmitter *em = e.emitter;
+		used += em->liveCount();
+		int want = em->pendingSpawn(dt);
+		int allowed = std::max(0, std::min(want, limit - used));
+		em->spawnScale = want > 0 ? (float)allowed / want : 1;
+		used += allowed;
+	}
+}
+
+// Call after the emitters update.  Measure what the frame cost, then cull
+// the oldest particles, lowest priority first, down to the limit.
+//
+void ParticleBudget::endFrame() {
+	frameMicros = ofGetElapsedTimeMicros() - startMicros;
+
+	// cost per particle, smoothed.  Tiny populations are all fixed
+	// overhead and would overestimate it
+	//
+	int n = total();
+	if (n >= minParticles) {
+		float cost = (float)frameMicros / n;
+		costMicros = costMicros == 0 ? cost : costMicros * 0.9f + cost * 0.1f;
+	}
+
+	culled = 0;
+	int excess = n - limit;
+	for (int i = (int)entries.size() - 1; i >= 0 && excess > 0; i--) {
+		int c = entries[i].emitter->cullOldest(excess);
+		culled += c;
+		excess -= c;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ParticleEmitter.h"
+
+//  Shared budget for every particle effect in the scene.  Emitters are
+//  registered with a priority; each frame the budget works out how many
+//  particles it can afford, from a hard cap on live particles and from
+//  the measured cost per particle against a CPU time budget.  Before the
+//  emitters update, their spawn groups are scaled down to the room left
+//  for them, highest priority first.  After they update, the oldest
+//  particles of the lowest priority effects are culled until the total
+//  is back under the limit, so several vehicles exploding in the same
+//  frame cannot blow up the frame time.
+//
+class ParticleBudget {
+public:
+	void add(ParticleEmitter *emitter, int priority);
+	void remove(ParticleEmitter *emitter);
+	void beginFrame(float dt);
+	void endFrame();
+	int total() const;
+
+	int maxParticles = 12000;       // hard cap on live particles
+	int minParticles = 1000;        // the time budget never cuts below this
+	uint64_t budgetMicros = 4000;   // CPU time allowed for particles per frame
+
+	// last frame
+	int limit = 12000;              // particles affordable this frame
+	int culled = 0;                 // particles culled at the end of it
+	uint64_t frameMicros = 0;       // time spent between beginFrame and endFrame
+	float costMicros = 0;           // smoothed cost of one live particle
+
+private:
+	struct Entry {
+		ParticleEmitter *emitter;
+		int priority;               // higher keeps its particles longer
+	};
+	vector<Entry> entries;          // sorted by priority, highest first
+	uint64_t startMicros = 0;
+};
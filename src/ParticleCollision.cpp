@@ -0,0 +1,179 @@
+#include "ParticleCollision.h"
+
+// Gather the terrain vertices in the box and bucket them, return false
+// when there are none
+//
+bool TerrainPatch::gather(const Octree &terrain, float minX, float minY, float minZ,
+	float maxX, float maxY, float maxZ, float minCell) {
+	Box query(Vector3(minX, minY, minZ), Vector3(maxX, maxY, maxZ));
+	if (!terrain.root.box.overlap(query)) return false;
+
+	leaves.clear();
+	points.clear();
+	terrain.leavesInBox(query, terrain.root, leaves);
+	if (leaves.empty()) return false;
+	for (const TreeNode *leaf : leaves) {
+		points.insert(points.end(), leaf->points.begin(), leaf->points.end());
+	}
+
+	const vector<glm::vec3> &verts = terrain.mesh.getVertices();
+	x0 = minX;
+	z0 = minZ;
+	float extent = std::max(maxX - minX, maxZ - minZ);
+	float cellSize = std::max(minCell, extent / 64);
+	inv = 1.0f / cellSize;
+	nx = (int)((maxX - x0) * inv) + 1;
+	nz = (int)((maxZ - z0) * inv) + 1;
+	int cells = nx * nz;
+
+	cellStart.assign(cells + 1, 0);
+	cellOf.resize(points.size());
+	sorted.resize(points.size());
+	for (int k = 0; k < (int)points.size(); k++) {
+		const glm::vec3 &v = verts[points[k]];
+		int cx = std::min(nx - 1, std::max(0, (int)((v.x - x0) * inv)));
+		int cz = std::min(nz - 1, std::max(0, (int)((v.z - z0) * inv)));
+		cellOf[k] = cz * nx + cx;
+		cellStart[cellOf[k] + 1]++;
+	}
+	for (int c = 0; c < cells; c++) cellStart[c + 1] += cellStart[c];
+	for (int k = (int)points.size() - 1; k >= 0; k--) {
+		sorted[--cellStart[cellOf[k] + 1]] = points[k];
+	}
+	for (int c = 0; c < cells; c++) cellStart[c] = cellStart[c + 1];
+	cellStart[cells] = (int)points.size();
+	return true;
+}
+
+// the start points and motions of one batch, in the terrain's frame
+//
+struct CollisionSegments {
+	vector<float> sx, sy, sz;
+	vector<float> dx, dy, dz;
+};
+
+// per-thread scratch space for one batch
+//
+static TerrainPatch &collisionScratch() {
+	thread_local TerrainPatch patch;
+	return patch;
+}
+
+static CollisionSegments &segmentScratch() {
+	thread_local CollisionSegments seg;
+	return seg;
+}
+
+/* Set the matrix from the particles' frame to the terrain's */
+void ParticleCollision::setTransform(const glm::mat4 &m) {
+	toWorld = m;
+	toLocal = glm::inverse(m);
+	identity = m == glm::mat4(1.0f);
+}
+
+/* Collide particles [begin, end) with the terrain for a step of dt, return number of hits */
+int ParticleCollision::collide(ParticleStore &ps, int begin, int end, float dt) const {
+	if (terrain == nullptr || dt <= 0) return 0;
+	int hits = 0;
+	for (int b = begin; b < end; b += batchSize) {
+		hits += collideBatch(ps, b, std::min(end, b + batchSize), dt);
+	}
+	return hits;
+}
+
+// One batch: map the motion segments to the terrain's frame and bound
+// them, fetch the terrain vertices in that box with a single traversal,
+// then find each particle's ground.
+//
+int ParticleCollision::collideBatch(ParticleStore &ps, int begin, int end, float dt) const {
+	int n = end - begin;
+	CollisionSegments &seg = segmentScratch();
+	seg.sx.resize(n); seg.sy.resize(n); seg.sz.resize(n);
+	seg.dx.resize(n); seg.dy.resize(n); seg.dz.resize(n);
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+	for (int k = 0; k < n; k++) {
+		int i = begin + k;
+		glm::vec3 s(ps.x[i], ps.y[i], ps.z[i]);
+		glm::vec3 d(ps.vx[i] * dt, ps.vy[i] * dt, ps.vz[i] * dt);
+		if (!identity) {
+			s = glm::vec3(toWorld * glm::vec4(s, 1));
+			d = glm::vec3(toWorld * glm::vec4(d, 0));
+		}
+		seg.sx[k] = s.x; seg.sy[k] = s.y; seg.sz[k] = s.z;
+		seg.dx[k] = d.x; seg.dy[k] = d.y; seg.dz[k] = d.z;
+
+		float ex = s.x + d.x, ey = s.y + d.y, ez = s.z + d.z;
+		minX = std::min(minX, std::min(s.x, ex)); maxX = std::max(maxX, std::max(s.x, ex));
+		minY = std::min(minY, std::min(s.y, ey)); maxY = std::max(maxY, std::max(s.y, ey));
+		minZ = std::min(minZ, std::min(s.z, ez)); maxZ = std::max(maxZ, std::max(s.z, ez));
+	}
+
+	// terrain above the highest start point cannot be reached this step,
+	// terrain below the lowest end point is not reached either
+	TerrainPatch &patch = collisionScratch();
+	if (!patch.gather(*terrain, minX - probeRadius, minY, minZ - probeRadius,
+		maxX + probeRadius, maxY, maxZ + probeRadius, probeRadius)) return 0;
+
+	const vector<glm::vec3> &verts = terrain->mesh.getVertices();
+	const vector<glm::vec3> &normals = terrain->mesh.getNormals();
+
+	float probe2 = probeRadius * probeRadius;
+	int hits = 0;
+
+	for (int k = 0; k < n; k++) {
+		int i = begin + k;
+		float sy = seg.sy[k];
+		float ey = sy + seg.dy[k];
+		float ex = seg.sx[k] + seg.dx[k];
+		float ez = seg.sz[k] + seg.dz[k];
+
+		// ground under the end of the segment, reachable from its start
+		int ground = -1;
+		float groundY = ey;
+		patch.forEachNear(ex, ez, [&](int idx) {
+			const glm::vec3 &v = verts[idx];
+			float dx = v.x - ex, dz = v.z - ez;
+			if (dx * dx + dz * dz > probe2) return;
+			if (v.y > groundY && v.y <= sy) {
+				groundY = v.y;
+				ground = idx;
+			}
+		});
+		if (ground < 0) continue;
+
+		glm::vec3 n(0, 1, 0);
+		if (ground < (int)normals.size()) n = normals[ground];
+		glm::vec3 v(ps.vx[i], ps.vy[i], ps.vz[i]);
+		if (!identity) v = glm::vec3(toWorld * glm::vec4(v, 0));
+		float vn = v.x * n.x + v.y * n.y + v.z * n.z;
+		if (vn >= 0) continue;    // already moving away from the surface
+
+		// move to where the segment crosses the ground
+		float t = (sy - groundY) / (sy - ey);
+		glm::vec3 p(seg.sx[k] + seg.dx[k] * t, groundY, seg.sz[k] + seg.dz[k] * t);
+
+		if (response == CollideStick) {
+			v = glm::vec3(0, 0, 0);
+		}
+		else {
+			// reflect the normal part, slow the tangential part
+			glm::vec3 tangent = v - vn * n;
+			v = tangent * (1.0f - friction) - vn * restitution * n;
+		}
+
+		if (!identity) {
+			p = glm::vec3(toLocal * glm::vec4(p, 1));
+			v = glm::vec3(toLocal * glm::vec4(v, 0));
+		}
+		ps.x[i] = p.x;
+		ps.y[i] = p.y;
+		ps.z[i] = p.z;
+		ps.vx[i] = v.x;
+		ps.vy[i] = v.y;
+		ps.vz[i] = v.z;
+		hits++;
+	}
+	return hits;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ParticleStore.h"
+#include "Octree.h"
+
+// what a particle does when it reaches the terrain
+//
+typedef enum { CollideBounce, CollideStick } CollisionResponse;
+
+//  The terrain vertices inside a box, gathered with one octree traversal
+//  and bucketed by xz cell (counting sort, as in ParticleGrid), so a point
+//  only has to look at the vertices in the 3 x 3 cells around it.  Cells
+//  are at least minCell wide.
+//
+class TerrainPatch {
+public:
+	bool gather(const Octree &terrain, float minX, float minY, float minZ,
+		float maxX, float maxY, float maxZ, float minCell);
+	template <typename F> void forEachNear(float x, float z, F f) const;
+
+	vector<const TreeNode *> leaves;
+	vector<int> points;       // terrain vertex indices in the box
+	vector<int> cellStart;    // cell c holds sorted[cellStart[c] .. cellStart[c + 1])
+	vector<int> sorted;
+	vector<int> cellOf;
+	float x0 = 0, z0 = 0, inv = 1;
+	int nx = 0, nz = 0;
+};
+
+// Call f(k) for every terrain vertex index k in the cells around (x, z)
+//
+template <typename F> void TerrainPatch::forEachNear(float x, float z, F f) const {
+	int cx = (int)((x - x0) * inv), cz = (int)((z - z0) * inv);
+	for (int jz = std::max(0, cz - 1); jz <= std::min(nz - 1, cz + 1); jz++) {
+		for (int jx = std::max(0, cx - 1); jx <= std::min(nx - 1, cx + 1); jx++) {
+			int c = jz * nx + jx;
+			for (int k = cellStart[c]; k < cellStart[c + 1]; k++) f(sorted[k]);
+		}
+	}
+}
+
+//  Particle-vs-terrain collision against the terrain octree.  It runs
+//  between the force and integration stages, when every particle's motion
+//  for the step is the segment from its position to position + v * dt.
+//
+//  Particles are handled in small batches of neighbors in the store,
+//  which are spawned together and move together.  Each batch gathers a
+//  TerrainPatch for the box around all its segments and tests each of
+//  its particles against the few vertices around it only.  The ground
+//  under a particle is the highest terrain vertex within probeRadius of
+//  it horizontally.
+//
+//  The particles may live in a frame of their own, like an emitter drawn
+//  under its lander's transform.  setTransform() gives the matrix from
+//  that frame to the terrain's; segments are mapped through it for the
+//  query and the bounced position and velocity are mapped back.
+//
+class ParticleCollision {
+public:
+	int collide(ParticleStore &ps, int begin, int end, float dt) const;
+	void setTransform(const glm::mat4 &m);
+
+	const Octree *terrain = nullptr;
+	glm::mat4 toWorld = glm::mat4(1.0f);    // particle frame to terrain frame
+	glm::mat4 toLocal = glm::mat4(1.0f);    // and back
+	bool identity = true;                   // frames are the same, skip the mapping
+	CollisionResponse response = CollideBounce;
+	float restitution = 0.3f;    // normal speed kept by a bounce
+	float friction = 0.2f;       // tangential speed lost by a bounce
+	float probeRadius = 2.0f;    // horizontal search radius for the ground
+	int batchSize = 256;         // particles sharing one octree traversal
+
+private:
+	int collideBatch(ParticleStore &ps, int begin, int end, float dt) const;
+};
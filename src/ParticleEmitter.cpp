@@ -2,9 +2,11 @@
 //  Kevin M. Smith - CS 134 SJSU
 
 #include "ParticleEmitter.h"
+#include "ParticleSystemPool.h"
+#include "glm/gtc/packing.hpp"
 
 ParticleEmitter::ParticleEmitter() {
-	sys = new ParticleSystem();
+	sys = ParticleSystemPool::shared().acquire();
 	createdSys = true;
 	init();
 }
@@ -23,28 +25,126 @@ ParticleEmitter::ParticleEmitter(ParticleSystem *s) {
 
 ParticleEmitter::~ParticleEmitter() {
 
-	// deallocate particle system if emitter created one internally
+	// hand the particle system back to the pool if the emitter took
+	// it from there
 	//
-	if (createdSys) delete sys;
+	if (createdSys) ParticleSystemPool::shared().release(sys);
 }
 
-// load vertex buffer in preparation for rendering
+// Heap and GPU memory this emitter holds: its particle system, the
+// vertex and element buffers and the staging copy
+//
+size_t ParticleEmitter::memoryBytes() const {
+	return sys->memoryBytes() + (size_t)vertexCapacity * sizeof(ParticleVertex)
+		+ staging.capacity() * sizeof(ParticleVertex) + (size_t)indexCapacity * sizeof(uint32_t);
+}
+
+// load vertex buffer in preparation for rendering.  The buffer is
+// allocated once for the whole particle pool; each frame the old contents
+// are orphaned so the driver never stalls on a buffer still being drawn,
+// and the live particles are written straight into the mapped memory.
 //
 void ParticleEmitter::loadVbo() {
-	if (sys->particles.size() < 1) return;
+	ParticleStore &ps = sys->particles;
+	int total = liveCount();
+	if (total < 1) return;
 
-	vector<ofVec3f> sizes;
-	vector<ofVec3f> points;
-	for (int i = 0; i < sys->particles.size(); i++) {
-		points.push_back(sys->particles[i].position);
-		sizes.push_back(ofVec3f(particleRadius));
+	// (re)allocate when the pool has grown past the buffer
+	//
+	if (ps.capacity() > vertexCapacity) {
+		vertexCapacity = ps.capacity();
+		vertices.allocate(vertexCapacity * sizeof(ParticleVertex), GL_STREAM_DRAW);
 	}
-	// upload the data to the vbo
+
+	// map just the live range, invalidating (orphaning) the old contents.
+	// Some drivers refuse to map; then orphan explicitly, pack into a
+	// staging copy and upload it with glBufferSubData
 	//
-	int total = (int)points.size();
-	vbo.clear();
-	vbo.setVertexData(&points[0], total, GL_STATIC_DRAW);
-	vbo.setNormalData(&sizes[0], total, GL_STATIC_DRAW);
+	size_t bytes = total * sizeof(ParticleVertex);
+	ParticleVertex *out = (ParticleVertex *)vertices.mapRange(0, bytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (out) {
+		packLive(out);
+		vertices.unmap();
+	}
+	else {
+		if ((int)staging.size() < vertexCapacity) staging.resize(vertexCapacity);
+		packLive(staging.data());
+		vertices.setData(vertexCapacity * sizeof(ParticleVertex), NULL, GL_STREAM_DRAW);
+		vertices.updateData(0, bytes, staging.data());
+	}
+}
+
+// sort the particles back to front for the current view and upload the
+// order as the element buffer, orphaned every frame like the vertices
+//
+void ParticleEmitter::loadIndices() {
+	ParticleStore &ps = sys->particles;
+	const vector<uint32_t> &order = sorter.sort(ps, ofGetCurrentMatrix(OF_MATRIX_MODELVIEW));
+	if (order.empty()) return;
+
+	if (ps.capacity() > indexCapacity) {
+		indexCapacity = ps.capacity();
+		indices.allocate(indexCapacity * sizeof(uint32_t), GL_STREAM_DRAW);
+	}
+	indices.setData(indexCapacity * sizeof(uint32_t), NULL, GL_STREAM_DRAW);
+	indices.updateData(0, order.size() * sizeof(uint32_t), order.data());
+}
+
+// write the live particles of "ps" as interleaved vertices
+//
+void ParticleEmitter::packVertices(const ParticleStore &ps, float size, ParticleVertex *out) {
+	packVertices(ps, 0, ps.size(), size, out);
+}
+
+/* Write particles [begin, end) of "ps" as interleaved vertices */
+void ParticleEmitter::packVertices(const ParticleStore &ps, int begin, int end, float size, ParticleVertex *out) {
+	uint16_t halfSize = glm::packHalf1x16(size);
+	for (int i = begin; i < end; i++, out++) {
+		out->x = ps.x[i];
+		out->y = ps.y[i];
+		out->z = ps.z[i];
+		out->size = halfSize;
+		out->age = glm::packHalf1x16(ps.age[i]);
+	}
+}
+
+// upload and draw the particles as points with the bound shader.  Position
+// goes through the classic vertex array so the GLSL 1.20 shaders keep
+// reading gl_Vertex; size and age are a half float "sizeAge" attribute.
+// Both are core in GL 2.1 + ARB_half_float_vertex, which Mesa's software
+// renderers support.  With depthSort the points are drawn in sorted
+// order through the element buffer.
+//
+void ParticleEmitter::drawVbo() {
+	loadVbo();
+	int total = liveCount();
+	if (total < 1) return;
+	if (depthSort) loadIndices();
+
+	GLsizei stride = sizeof(ParticleVertex);
+	GLint sizeAge = shader.getAttributeLocation("sizeAge");
+
+	vertices.bind(GL_ARRAY_BUFFER);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, stride, (void *)offsetof(ParticleVertex, x));
+	if (sizeAge >= 0) {
+		glEnableVertexAttribArray(sizeAge);
+		glVertexAttribPointer(sizeAge, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void *)offsetof(ParticleVertex, size));
+	}
+
+	if (depthSort) {
+		indices.bind(GL_ELEMENT_ARRAY_BUFFER);
+		glDrawElements(GL_POINTS, total, GL_UNSIGNED_INT, NULL);
+		indices.unbind(GL_ELEMENT_ARRAY_BUFFER);
+	}
+	else {
+		glDrawArrays(GL_POINTS, 0, total);
+	}
+
+	if (sizeAge >= 0) glDisableVertexAttribArray(sizeAge);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	vertices.unbind(GL_ARRAY_BUFFER);
 }
 
 void ParticleEmitter::init() {
@@ -54,12 +154,14 @@ void ParticleEmitter::init() {
 	started = false;
 	oneShot = false;
 	fired = false;
+	clock = 0;
 	lastSpawned = 0;
 	radius = 1;
 	particleRadius = 1;
 	visible = true;
 	type = DirectionalEmitter;
 	groupSize = 1;
+	spawnScale = 1;
 }
 
 void ParticleEmitter::setup() {
@@ -81,36 +183,46 @@ void ParticleEmitter::setup() {
 
 void ParticleEmitter::draw() {
 	if (visible) {
-		loadVbo();
 		switch (type) {
 		case DirectionalEmitter:
 			ofDrawSphere(pos, radius/10);  // just draw a small sphere for point emitters 
 			break;
 		case SphereEmitter:
 		case DiskEmitter:
-			// this makes everything look glowy :)
-			ofEnableBlendMode(OF_BLENDMODE_ADD);
+			// this makes everything look glowy :), unless sorted for
+			// plain alpha blending
+			ofEnableBlendMode(depthSort ? OF_BLENDMODE_ALPHA : OF_BLENDMODE_ADD);
 			ofEnablePointSprites();
+			if (depthSort) glDepthMask(GL_FALSE);
 			shader.begin();
 			//ofDrawSphere(pos, radius/10);  // just draw a small sphere as a placeholder
 			particleTex.bind();
-			vbo.draw(GL_POINTS, 0, (int)sys->particles.size());
+			drawVbo();
 			particleTex.unbind();
 
 			shader.end();
+			if (depthSort) glDepthMask(GL_TRUE);
 
 			ofDisablePointSprites();
 			ofDisableBlendMode();
 			ofEnableAlphaBlending();
 			break;
 		case RadialEmitter:
+			// sorted back to front, alpha blending composes correctly
+			// (smoke); depth writes would still cut holes in it
+			if (depthSort) {
+				ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+				ofEnablePointSprites();
+				glDepthMask(GL_FALSE);
+			}
 			shader.begin();
 			//ofDrawSphere(pos, radius/10);  // just draw a small sphere as a placeholder
 			particleTex.bind();
-			vbo.draw(GL_POINTS, 0, (int)sys->particles.size());
+			drawVbo();
 			particleTex.unbind();
 
 			shader.end();
+			if (depthSort) glDepthMask(GL_TRUE);
 
 			ofDisablePointSprites();
 			ofDisableBlendMode();
@@ -125,90 +237,188 @@ void ParticleEmitter::draw() {
 }
 void ParticleEmitter::start() {
 	started = true;
-	lastSpawned = ofGetElapsedTimeMillis();
+	lastSpawned = clock;
 }
 
 void ParticleEmitter::stop() {
 	started = false;
 	fired = false;
 }
-void ParticleEmitter::update() {
+// advance the emitter by "dt" seconds of simulation time, spawning on the
+// simulation clock so pauses and fast-forward affect emission too
+//
+void ParticleEmitter::update(float dt) {
 
-	float time = ofGetElapsedTimeMillis();
+	clock += dt;
 	if (oneShot && started) {
 		if (!fired) {
 			// spawn a new particle(s)
 			//
-			for (int i = 0; i < groupSize; i++)
-				spawn(time);
+			spawnGroup();
 
-			lastSpawned = time;
+			lastSpawned = clock;
 		}
 		fired = true;
 		stop();
 	}
 
-	else if (((time - lastSpawned) > (1000.0 / rate)) && started) {
+	else if (((clock - lastSpawned) > (1.0 / rate)) && started) {
 
 		// spawn a new particle(s)
 		//
-		for (int i= 0; i < groupSize; i++)
-			spawn(time);
+		spawnGroup();
 	
-		lastSpawned = time;
+		lastSpawned = clock;
 	}
 
-	sys->update();
+	sys->update(dt);
 }
 
-// spawn a single particle.  time is current time of birth
+// append emitter and particle state to a snapshot
 //
-void ParticleEmitter::spawn(float time) {
+void ParticleEmitter::saveState(SimSnapshot &snap) {
+	DynamicShape::saveState(snap);
+	snap.put(started);
+	snap.put(fired);
+	snap.put(clock);
+	snap.put(lastSpawned);
+	snap.put(visible);
+	snap.put(rng);
+	snap.put(lanes);
+	sys->saveState(snap);
+}
 
-	Particle particle;
+// read back the state written by saveState
+//
+void ParticleEmitter::restoreState(SimSnapshot &snap) {
+	DynamicShape::restoreState(snap);
+	snap.get(started);
+	snap.get(fired);
+	snap.get(clock);
+	snap.get(lastSpawned);
+	snap.get(visible);
+	snap.get(rng);
+	snap.get(lanes);
+	sys->restoreState(snap);
+}
+
+// number of particles update(dt) is about to spawn, before spawnScale
+//
+int ParticleEmitter::pendingSpawn(float dt) const {
+	if (!started) return 0;
+	if (oneShot) return fired ? 0 : groupSize;
+	return (clock + dt - lastSpawned) > (1.0 / rate) ? groupSize : 0;
+}
+
+// spawn a group of "groupSize" particles, scaled by spawnScale
+//
+void ParticleEmitter::spawnGroup() {
+	int n = groupSize;
+	if (spawnScale < 1) {
+		// round randomly so small groups still spawn at the scaled rate
+		n = (int)(groupSize * spawnScale + rng.uniform());
+		if (n <= 0) return;
+	}
+	spawnN(n);
+}
+
+// Spawn "n" newborn particles at once and return how many the pool had
+// room for.  The slots are reserved in one go and filled by spawnAt().
+//
+int ParticleEmitter::spawnN(int n) {
+	ParticleStore &ps = sys->particles;
+	int first = ps.alloc(n);
+	n = ps.size() - first;
+	if (n <= 0) return 0;
+	spawnAt(first, n);
+	return n;
+}
+
+// Fill slots [first, first + n) of the store with newborn particles.  The
+// random numbers for the whole group are drawn in batches, and each
+// emitter type fills its positions and velocities in its own straight
+// loop over the arrays.
+//
+void ParticleEmitter::spawnAt(int first, int n) {
+	ParticleStore &ps = sys->particles;
+	ps.touch();
+	float *x = ps.x.data() + first, *y = ps.y.data() + first, *z = ps.z.data() + first;
+	float *vx = ps.vx.data() + first, *vy = ps.vy.data() + first, *vz = ps.vz.data() + first;
+	float speed = particleVelocity.length();
 
-	// set initial velocity and position
-	// based on emitter type
-	//
 	switch (type) {
 	case RadialEmitter:
 	{
-		ofVec3f dir = ofVec3f(ofRandom(-1, 1), ofRandom(-1, 1), ofRandom(-1, 1));
-		float speed = particleVelocity.length();
-		particle.velocity = dir.getNormalized() * speed;
-		particle.position.set(pos);
+		// random directions from the emitter, at the particle speed
+		vector<float> &r = particleScratch(3 * n);
+		lanes.fill(r.data(), 3 * n, -1, 1);
+		const float *dx = &r[0], *dy = &r[n], *dz = &r[2 * n];
+		for (int i = 0; i < n; i++) {
+			float s = speed / sqrt(dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i] + 1e-12f);
+			x[i] = pos.x;
+			y[i] = pos.y;
+			z[i] = pos.z;
+			vx[i] = dx[i] * s;
+			vy[i] = dy[i] * s;
+			vz[i] = dz[i] * s;
+		}
+		break;
 	}
-	break;
 	case SphereEmitter:
+	{
+		// uniform points on the sphere of "radius", moving straight out
+		vector<float> &r = particleScratch(2 * n);
+		lanes.fill(&r[0], n, -1, 1);
+		lanes.fill(&r[n], n, 0, TWO_PI);
+		const float *h = &r[0], *phi = &r[n];
+		for (int i = 0; i < n; i++) {
+			float ring = sqrt(1 - h[i] * h[i]);
+			float dx = ring * cos(phi[i]), dy = h[i], dz = ring * sin(phi[i]);
+			x[i] = pos.x + dx * radius;
+			y[i] = pos.y + dy * radius;
+			z[i] = pos.z + dz * radius;
+			vx[i] = dx * speed;
+			vy[i] = dy * speed;
+			vz[i] = dz * speed;
+		}
 		break;
+	}
 	case DiskEmitter:
 	{
-		float speed = particleVelocity.length() * 0.1;
-		particle.velocity = ofVec3f(0, -speed, 0);
-
-		// emit from a disk shape instead of a singular point
-		float angle = ofRandom(0, TWO_PI); // Random angle in a full circle
-		float distance = ofRandom(0, radius); // Random distance from center
-		float x = cos(angle) * distance;
-		float z = sin(angle) * distance;
-
-		particle.position.set(ofVec3f(x, pos.y, z)); // Ensures a circular area
+		// emit from a disk shape instead of a singular point, falling
+		vector<float> &r = particleScratch(2 * n);
+		lanes.fill(&r[0], n, 0, TWO_PI);    // angle in a full circle
+		lanes.fill(&r[n], n, 0, radius);    // distance from center
+		const float *angle = &r[0], *distance = &r[n];
+		float fall = -speed * 0.1f;
+		for (int i = 0; i < n; i++) {
+			x[i] = cos(angle[i]) * distance[i];
+			y[i] = pos.y;
+			z[i] = sin(angle[i]) * distance[i];
+			vx[i] = 0;
+			vy[i] = fall;
+			vz[i] = 0;
+		}
 		break;
 	}
 	case DirectionalEmitter:
-		particle.velocity = particleVelocity;
-		particle.position.set(pos);
+		std::fill(x, x + n, pos.x);
+		std::fill(y, y + n, pos.y);
+		std::fill(z, z + n, pos.z);
+		std::fill(vx, vx + n, particleVelocity.x);
+		std::fill(vy, vy + n, particleVelocity.y);
+		std::fill(vz, vz + n, particleVelocity.z);
 		break;
 	}
 
-	// other particle attributes
-	//
-	particle.lifespan = lifespan;
-	particle.birthtime = time;
-	particle.radius = particleRadius;
-	particle.mass = mass;
-
-	// add to system
+	// attributes shared by the whole group
 	//
-	sys->add(particle);
+	std::fill(ps.fx.begin() + first, ps.fx.begin() + first + n, 0.0f);
+	std::fill(ps.fy.begin() + first, ps.fy.begin() + first + n, 0.0f);
+	std::fill(ps.fz.begin() + first, ps.fz.begin() + first + n, 0.0f);
+	std::fill(ps.lifespan.begin() + first, ps.lifespan.begin() + first + n, lifespan);
+	std::fill(ps.age.begin() + first, ps.age.begin() + first + n, 0.0f);
+	std::fill(ps.radius.begin() + first, ps.radius.begin() + first + n, particleRadius);
+	std::fill(ps.mass.begin() + first, ps.mass.begin() + first + n, mass);
+	std::fill(ps.damping.begin() + first, ps.damping.begin() + first + n, .99f);
 }
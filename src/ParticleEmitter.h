@@ -3,9 +3,20 @@
 
 #include "Shape.h"
 #include "ParticleSystem.h"
+#include "ParticleSort.h"
+#include "Rng.h"
 
 typedef enum { DirectionalEmitter, RadialEmitter, SphereEmitter, DiskEmitter } EmitterType;
 
+//  One particle in the streaming vertex buffer: position plus size and
+//  age (sec) as half floats, 16 bytes per particle
+//
+struct ParticleVertex {
+	float x, y, z;
+	uint16_t size;
+	uint16_t age;
+};
+
 //  General purpose Emitter class for emitting sprites
 //  This works similar to a Particle emitter
 //
@@ -13,8 +24,15 @@ class ParticleEmitter : public DynamicShape {
 public:
 	ParticleEmitter();
 	ParticleEmitter(ParticleSystem *s);
-	~ParticleEmitter();
+	virtual ~ParticleEmitter();
+	ParticleEmitter(const ParticleEmitter &) = delete;
+	ParticleEmitter &operator=(const ParticleEmitter &) = delete;
+	size_t memoryBytes() const;
 	void loadVbo();
+	void loadIndices();
+	void drawVbo();
+	static void packVertices(const ParticleStore &ps, float size, ParticleVertex *out);
+	static void packVertices(const ParticleStore &ps, int begin, int end, float size, ParticleVertex *out);
 	void init();
 	void setup();
 	void draw();
@@ -28,8 +46,20 @@ public:
 	void setEmitterType(EmitterType t) { type = t; }
 	void setGroupSize(int s) { groupSize = s; }
 	void setOneShot(bool s) { oneShot = s; }
-	void update();
-	void spawn(float time);
+	void setCapacity(int n) { sys->particles.setCapacity(n); }
+	void setOverflow(ParticleOverflow o) { sys->particles.setOverflow(o); }
+	void setDepthSort(bool s) { depthSort = s; }
+	void setSeed(uint64_t s) { rng.seed(s); lanes.seed(s, 1); sys->setSeed(s); }
+	virtual void update(float dt);
+	virtual int pendingSpawn(float dt) const;
+	virtual int liveCount() const { return sys->particles.size(); }
+	virtual int cullOldest(int n) { return sys->particles.cullOldest(n); }
+	virtual void packLive(ParticleVertex *out) { packVertices(sys->particles, particleRadius, out); }
+	void spawnGroup();
+	int spawnN(int n);
+	void spawnAt(int first, int n);
+	virtual void saveState(SimSnapshot &snap);
+	virtual void restoreState(SimSnapshot &snap);
 	ParticleSystem *sys;
 	float rate;         // per sec
 	bool oneShot;
@@ -37,19 +67,35 @@ public:
 	ofVec3f particleVelocity;
 	float lifespan;     // sec
 	bool started;
-	float lastSpawned;  // ms
+	float clock;        // sec of simulation time, advanced by update()
+	float lastSpawned;  // sec, on clock
 	float particleRadius;
 	float radius;
 	bool visible;
 	int groupSize;      // number of particles to spawn in a group
-	bool createdSys;
+	float spawnScale;   // fraction of groupSize actually spawned, set by ParticleBudget
+	bool createdSys;    // sys came from the ParticleSystemPool and goes back there
 	EmitterType type;
+	Rng rng;            // spawn randomness, reproducible from setSeed()
+	RngLanes lanes;     // batches of spawn randomness for spawnN()
 
 	/* Particle Rendering */
 	// textures
 	ofTexture  particleTex;
 
+	// streaming vertex buffer, sized to the particle pool and refilled
+	// every frame
+	ofBufferObject vertices;
+	int vertexCapacity = 0;       // particles the buffer has room for
+	vector<ParticleVertex> staging;    // used only when the buffer cannot be mapped
+
+	// optional back-to-front drawing with alpha blending, through a
+	// sorted element buffer
+	bool depthSort = false;
+	ParticleDepthSort sorter;
+	ofBufferObject indices;
+	int indexCapacity = 0;        // particles the element buffer has room for
+
 	// shader
-	ofVbo vbo;
 	ofShader shader;
 };
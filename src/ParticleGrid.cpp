@@ -0,0 +1,57 @@
+#include "ParticleGrid.h"
+
+// Rebuild the grid from the current particle positions.  The bucket table
+// is the next power of two at or above twice the particle count, so
+// buckets stay short; the arrays only ever grow.
+//
+void ParticleGrid::build(const ParticleStore &ps) {
+	store = &ps;
+	count = ps.size();
+	invCellSize = 1.0f / cellSize;
+
+	uint32_t buckets = 64;
+	while (buckets < 2 * (uint32_t)count) buckets <<= 1;
+	mask = buckets - 1;
+
+	if (cellStart.size() < buckets + 1) cellStart.resize(buckets + 1);
+	if ((int)sorted.size() < count) {
+		sorted.resize(count);
+		bucketOf.resize(count);
+	}
+	std::fill(cellStart.begin(), cellStart.begin() + buckets + 1, 0);
+
+	// count the particles in each bucket
+	for (int i = 0; i < count; i++) {
+		uint32_t b = bucket(cell(ps.x[i]), cell(ps.y[i]), cell(ps.z[i]));
+		bucketOf[i] = b;
+		cellStart[b + 1]++;
+	}
+
+	// prefix sum gives each bucket its start in "sorted"
+	for (uint32_t b = 0; b < buckets; b++) {
+		cellStart[b + 1] += cellStart[b];
+	}
+
+	// scatter, filling each bucket backwards from its end.  That leaves
+	// cellStart[b + 1] at the start of bucket b, so shift it down one
+	for (int i = count - 1; i >= 0; i--) {
+		uint32_t b = bucketOf[i];
+		sorted[--cellStart[b + 1]] = i;
+	}
+	for (uint32_t b = 0; b < buckets; b++) {
+		cellStart[b] = cellStart[b + 1];
+	}
+	cellStart[buckets] = count;
+}
+
+/* Collect the indices of every particle within "radius" of point */
+void ParticleGrid::query(const ofVec3f &point, float radius, vector<int> &out) {
+	out.clear();
+	forEachNear(point, radius, [&out](int i) { out.push_back(i); });
+}
+
+/* Heap memory held by the hash table and its scratch arrays */
+size_t ParticleGrid::memoryBytes() const {
+	return (cellStart.capacity() + sorted.capacity()) * sizeof(int)
+		+ (bucketOf.capacity() + visited.capacity()) * sizeof(uint32_t);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ParticleStore.h"
+
+//  Uniform grid spatial hash over particle positions.  Space is cut into
+//  cubes of cellSize and every cube is hashed into a fixed table of
+//  buckets.  build() sorts the particle indices by bucket with a counting
+//  sort, so each bucket is one contiguous run of "sorted" and a rebuild
+//  touches only flat arrays that are reused from frame to frame.
+//
+//  Queries visit the buckets of every cell overlapping the query sphere and
+//  test the actual distance, which also filters out particles from other
+//  cells that hash to the same bucket.
+//
+class ParticleGrid {
+public:
+	void build(const ParticleStore &ps);
+	void query(const ofVec3f &point, float radius, vector<int> &out);
+	template <typename F> void forEachNear(const ofVec3f &point, float radius, F f);
+	template <typename F> void forEachNeighbor(int i, float radius, F f);
+	int size() const { return count; }
+	size_t memoryBytes() const;
+
+	float cellSize = 2;
+
+	// bucket b holds sorted[cellStart[b] .. cellStart[b + 1])
+	vector<int> cellStart;
+	vector<int> sorted;
+
+private:
+	uint32_t bucket(int ix, int iy, int iz) const {
+		return ((uint32_t)ix * 73856093u ^ (uint32_t)iy * 19349663u ^ (uint32_t)iz * 83492791u) & mask;
+	}
+	int cell(float v) const { return (int)floor(v * invCellSize); }
+
+	const ParticleStore *store = nullptr;
+	int count = 0;
+	uint32_t mask = 0;
+	float invCellSize = 0.5f;
+	vector<uint32_t> bucketOf;    // bucket of each particle, from build()
+	vector<uint32_t> visited;     // buckets already visited by the current query
+};
+
+// Call f(i) for every particle i within "radius" of point.  Very large
+// queries, covering more cells than there are particles, scan the
+// particles directly instead.
+//
+template <typename F> void ParticleGrid::forEachNear(const ofVec3f &point, float radius, F f) {
+	if (count == 0) return;
+	const ParticleStore &ps = *store;
+	float r2 = radius * radius;
+
+	int x0 = cell(point.x - radius), x1 = cell(point.x + radius);
+	int y0 = cell(point.y - radius), y1 = cell(point.y + radius);
+	int z0 = cell(point.z - radius), z1 = cell(point.z + radius);
+	int64_t cells = (int64_t)(x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1);
+
+	if (cells > count || cells > 512) {
+		for (int i = 0; i < count; i++) {
+			float dx = ps.x[i] - point.x, dy = ps.y[i] - point.y, dz = ps.z[i] - point.z;
+			if (dx * dx + dy * dy + dz * dz <= r2) f(i);
+		}
+		return;
+	}
+
+	visited.clear();
+	for (int iz = z0; iz <= z1; iz++) {
+		for (int iy = y0; iy <= y1; iy++) {
+			for (int ix = x0; ix <= x1; ix++) {
+				// neighboring cells can share a bucket, visit it once
+				uint32_t b = bucket(ix, iy, iz);
+				if (std::find(visited.begin(), visited.end(), b) != visited.end()) continue;
+				visited.push_back(b);
+
+				for (int k = cellStart[b]; k < cellStart[b + 1]; k++) {
+					int i = sorted[k];
+					float dx = ps.x[i] - point.x, dy = ps.y[i] - point.y, dz = ps.z[i] - point.z;
+					if (dx * dx + dy * dy + dz * dz <= r2) f(i);
+				}
+			}
+		}
+	}
+}
+
+/* Call f(j) for every other particle j within "radius" of particle i */
+template <typename F> void ParticleGrid::forEachNeighbor(int i, float radius, F f) {
+	const ParticleStore &ps = *store;
+	forEachNear(ofVec3f(ps.x[i], ps.y[i], ps.z[i]), radius, [i, &f](int j) {
+		if (j != i) f(j);
+	});
+}
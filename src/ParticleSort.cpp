@@ -0,0 +1,94 @@
+#include "ParticleSort.h"
+#include "WorkerPool.h"
+
+// Sort the live particles of "ps" back to front as seen through
+// "modelView" and return the order
+//
+const vector<uint32_t> &ParticleDepthSort::sort(const ParticleStore &ps, const glm::mat4 &modelView) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	int n = ps.size();
+	order.resize(n);
+	if (n == 0) {
+		sortMicros = 0;
+		return order;
+	}
+	depth.resize(n);
+	keys.resize(n);
+	keysOut.resize(n);
+	orderOut.resize(n);
+
+	WorkerPool &pool = WorkerPool::shared();
+	int chunks = (n + grain - 1) / grain;
+	chunkMin.assign(chunks, FLT_MAX);
+	chunkMax.assign(chunks, -FLT_MAX);
+
+	// view space z, the camera looks down -z so the farthest particle has
+	// the smallest z.  Only the z row of the matrix is needed
+	//
+	float m0 = modelView[0][2], m1 = modelView[1][2], m2 = modelView[2][2], m3 = modelView[3][2];
+	const float *x = ps.x.data(), *y = ps.y.data(), *z = ps.z.data();
+	float *d = depth.data();
+	pool.parallelFor(n, grain, [&](int begin, int end, int chunk) {
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		for (int i = begin; i < end; i++) {
+			d[i] = m0 * x[i] + m1 * y[i] + m2 * z[i] + m3;
+			lo = std::min(lo, d[i]);
+			hi = std::max(hi, d[i]);
+		}
+		chunkMin[chunk] = lo;
+		chunkMax[chunk] = hi;
+	});
+	float lo = *std::min_element(chunkMin.begin(), chunkMin.end());
+	float hi = *std::max_element(chunkMax.begin(), chunkMax.end());
+
+	// quantize, farthest to key 0
+	float scale = hi > lo ? 65535.0f / (hi - lo) : 0;
+	pool.parallelFor(n, grain, [&](int begin, int end, int) {
+		for (int i = begin; i < end; i++) {
+			keys[i] = (uint16_t)((d[i] - lo) * scale);
+			order[i] = i;
+		}
+	});
+
+	radixPass(n, 0);
+	radixPass(n, 8);
+
+	sortMicros = ofGetElapsedTimeMicros() - start;
+	return order;
+}
+
+// One stable counting sort of keys and order on the 8 bit digit at "shift"
+//
+void ParticleDepthSort::radixPass(int n, int shift) {
+	WorkerPool &pool = WorkerPool::shared();
+	int chunks = (n + grain - 1) / grain;
+	offsets.assign(chunks * 256, 0);
+
+	pool.parallelFor(n, grain, [&](int begin, int end, int chunk) {
+		uint32_t *count = &offsets[chunk * 256];
+		for (int i = begin; i < end; i++) count[(keys[i] >> shift) & 0xff]++;
+	});
+
+	// digit-major prefix sum: every chunk writes its share of a digit
+	// right after the earlier chunks' share
+	uint32_t total = 0;
+	for (int digit = 0; digit < 256; digit++) {
+		for (int c = 0; c < chunks; c++) {
+			uint32_t count = offsets[c * 256 + digit];
+			offsets[c * 256 + digit] = total;
+			total += count;
+		}
+	}
+
+	pool.parallelFor(n, grain, [&](int begin, int end, int chunk) {
+		uint32_t *next = &offsets[chunk * 256];
+		for (int i = begin; i < end; i++) {
+			uint32_t k = next[(keys[i] >> shift) & 0xff]++;
+			keysOut[k] = keys[i];
+			orderOut[k] = order[i];
+		}
+	});
+
+	keys.swap(keysOut);
+	order.swap(orderOut);
+}
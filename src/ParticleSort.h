@@ -0,0 +1,34 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ParticleStore.h"
+
+//  Back-to-front ordering of particles for alpha blending.  Every particle
+//  gets a 16 bit key, its view depth quantized between the farthest and
+//  the nearest particle, and the keys are radix sorted in two 8 bit
+//  passes together with the particle indices.  Only the index list is
+//  sorted: the particle arrays stay where they are and the indices go to
+//  an element buffer for glDrawElements.
+//
+//  Each pass counts digits over fixed chunks of particles in parallel,
+//  turns the counts into an output offset per chunk and digit, then
+//  scatters the chunks in parallel into their own ranges.  The sort is
+//  stable and gives the same order on any number of threads.
+//
+class ParticleDepthSort {
+public:
+	const vector<uint32_t> &sort(const ParticleStore &ps, const glm::mat4 &modelView);
+
+	vector<uint32_t> order;       // particle indices, farthest first
+	uint64_t sortMicros = 0;      // time the last sort took
+	int grain = 8192;             // particles per parallel chunk
+
+private:
+	void radixPass(int n, int shift);
+
+	vector<float> depth;          // view space z of every particle
+	vector<uint16_t> keys, keysOut;
+	vector<uint32_t> orderOut;
+	vector<uint32_t> offsets;     // 256 per chunk
+	vector<float> chunkMin, chunkMax;
+};
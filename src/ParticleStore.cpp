@@ -0,0 +1,316 @@
+#include "ParticleStore.h"
+
+/* Allocate the pool arrays for "n" particles, keeping live particles that fit */
+void ParticleStore::setCapacity(int n) {
+	forEachArray([n](vector<float> &a) { a.resize(n); });
+	dead.resize(n);
+	if (count > n) count = n;
+	version++;
+}
+
+// Bump "n" new particles into the free slots and return the index of the
+// first one.  The new slots are uninitialized and end at size(), so the
+// caller fills slots [first, size()).  When the pool is full the overflow
+// policy either drops the oldest particles to make room or grants fewer
+// slots than asked for (possibly none).
+//
+int ParticleStore::alloc(int n) {
+	if (capacity() == 0) setCapacity(defaultCapacity);
+	int cap = capacity();
+	if (n > cap) {
+		dropped += n - cap;
+		n = cap;
+	}
+
+	int over = count + n - cap;
+	if (over > 0) {
+		dropped += over;
+		if (overflow == DropOldest) dropFront(over);
+		else n -= over;
+	}
+
+	int first = count;
+	count += n;
+	if (count > highWater) highWater = count;
+	version++;
+	return first;
+}
+
+/* Append a particle */
+void ParticleStore::add(const Particle &p) {
+	int i = alloc(1);
+	if (i == count) return;    // pool full, particle dropped
+	x[i] = p.position.x;
+	y[i] = p.position.y;
+	z[i] = p.position.z;
+	vx[i] = p.velocity.x;
+	vy[i] = p.velocity.y;
+	vz[i] = p.velocity.z;
+	fx[i] = p.forces.x;
+	fy[i] = p.forces.y;
+	fz[i] = p.forces.z;
+	mass[i] = p.mass;
+	damping[i] = p.damping;
+	radius[i] = p.radius;
+	lifespan[i] = p.lifespan;
+	age[i] = p.elapsed;
+}
+
+/* Gather particle i into a Particle value */
+Particle ParticleStore::get(int i) const {
+	Particle p;
+	p.position.set(x[i], y[i], z[i]);
+	p.velocity.set(vx[i], vy[i], vz[i]);
+	p.forces.set(fx[i], fy[i], fz[i]);
+	p.mass = mass[i];
+	p.damping = damping[i];
+	p.radius = radius[i];
+	p.lifespan = lifespan[i];
+	p.elapsed = age[i];
+	return p;
+}
+
+/* Remove particle i, keeping the order of the others */
+void ParticleStore::remove(int i) {
+	int n = count;
+	forEachArray([i, n](vector<float> &a) {
+		std::copy(a.begin() + i + 1, a.begin() + n, a.begin() + i);
+	});
+	count--;
+	version++;
+}
+
+/* Remove the "n" oldest particles (the front of the pool) */
+void ParticleStore::dropFront(int n) {
+	int left = count - n;
+	forEachArray([n, left](vector<float> &a) {
+		memmove(a.data(), a.data() + n, left * sizeof(float));
+	});
+	count = left;
+	version++;
+}
+
+/* Remove up to "n" of the oldest particles, return number removed */
+int ParticleStore::cullOldest(int n) {
+	n = std::min(n, count);
+	if (n > 0) dropFront(n);
+	return n;
+}
+
+// Remove every particle flagged in "dead" in one stable pass: survivors
+// are moved down over the removed ones, keeping their order, and the
+// freed slots at the end go back to the pool.  Return number removed.
+//
+int ParticleStore::compact() {
+	int n = size();
+
+	// skip the leading run of survivors, they stay where they are
+	int first = 0;
+	while (first < n && !dead[first]) first++;
+	if (first == n) return 0;
+
+	int out = first;
+	for (int i = first + 1; i < n; i++) {
+		if (dead[i]) continue;
+		x[out] = x[i];
+		y[out] = y[i];
+		z[out] = z[i];
+		vx[out] = vx[i];
+		vy[out] = vy[i];
+		vz[out] = vz[i];
+		fx[out] = fx[i];
+		fy[out] = fy[i];
+		fz[out] = fz[i];
+		mass[out] = mass[i];
+		damping[out] = damping[i];
+		radius[out] = radius[i];
+		lifespan[out] = lifespan[i];
+		age[out] = age[i];
+		out++;
+	}
+
+	count = out;
+	version++;
+	return n - out;
+}
+
+// Remove particles that have exceeded their lifespan (-1 lives forever).
+// The flagging loop is branch free and vectorizes; compaction only runs
+// when something actually expired.
+//
+int ParticleStore::removeExpired() {
+	int n = size();
+	const float *a = age.data(), *l = lifespan.data();
+	uint8_t *d = dead.data();
+	int expired = 0;
+	for (int i = 0; i < n; i++) {
+		uint8_t e = (l[i] != -1) & (a[i] > l[i]);
+		d[i] = e;
+		expired += e;
+	}
+	if (expired == 0) return 0;
+	return compact();
+}
+
+/* Remove particles within "dist" of point, return number removed */
+int ParticleStore::removeNear(const ofVec3f &point, float dist) {
+	int n = size();
+	float dist2 = dist * dist;
+	for (int i = 0; i < n; i++) {
+		float dx = x[i] - point.x;
+		float dy = y[i] - point.y;
+		float dz = z[i] - point.z;
+		dead[i] = dx * dx + dy * dy + dz * dz <= dist2;
+	}
+	return compact();
+}
+
+/* Remove all particles (capacity is kept) */
+void ParticleStore::clear() {
+	count = 0;
+	version++;
+}
+
+// Euler integration of every particle, same as Particle::integrate:
+//
+//    position += velocity * dt
+//    velocity  = (velocity + forces / mass * dt) * damping
+//    forces    = 0
+//    age      += dt
+//
+// The SIMD loop handles groups of 4 (SSE) or 8 (AVX) particles and the
+// scalar loop finishes the remainder.
+//
+void ParticleStore::integrate(float dt) {
+	integrate(0, size(), dt);
+	version++;
+}
+
+/* Integrate particles [begin, end) only, so chunks can run on separate threads */
+void ParticleStore::integrate(int begin, int end, float dt) {
+	int n = end;
+	int i = begin;
+
+	float *px = x.data(), *py = y.data(), *pz = z.data();
+	float *pvx = vx.data(), *pvy = vy.data(), *pvz = vz.data();
+	float *pfx = fx.data(), *pfy = fy.data(), *pfz = fz.data();
+	const float *pm = mass.data(), *pd = damping.data();
+	float *pa = age.data();
+
+#if defined(PARTICLE_SIMD_AVX)
+	const __m256 h = _mm256_set1_ps(dt);
+	const __m256 zero = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8) {
+		__m256 u = _mm256_loadu_ps(pvx + i);
+		__m256 v = _mm256_loadu_ps(pvy + i);
+		__m256 w = _mm256_loadu_ps(pvz + i);
+
+		// update position based on velocity
+		_mm256_storeu_ps(px + i, _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(u, h)));
+		_mm256_storeu_ps(py + i, _mm256_add_ps(_mm256_loadu_ps(py + i), _mm256_mul_ps(v, h)));
+		_mm256_storeu_ps(pz + i, _mm256_add_ps(_mm256_loadu_ps(pz + i), _mm256_mul_ps(w, h)));
+
+		// a = f / m, then damp the new velocity
+		__m256 hm = _mm256_div_ps(h, _mm256_loadu_ps(pm + i));
+		__m256 d = _mm256_loadu_ps(pd + i);
+		u = _mm256_mul_ps(_mm256_add_ps(u, _mm256_mul_ps(_mm256_loadu_ps(pfx + i), hm)), d);
+		v = _mm256_mul_ps(_mm256_add_ps(v, _mm256_mul_ps(_mm256_loadu_ps(pfy + i), hm)), d);
+		w = _mm256_mul_ps(_mm256_add_ps(w, _mm256_mul_ps(_mm256_loadu_ps(pfz + i), hm)), d);
+		_mm256_storeu_ps(pvx + i, u);
+		_mm256_storeu_ps(pvy + i, v);
+		_mm256_storeu_ps(pvz + i, w);
+
+		// clear forces (they get re-added each step)
+		_mm256_storeu_ps(pfx + i, zero);
+		_mm256_storeu_ps(pfy + i, zero);
+		_mm256_storeu_ps(pfz + i, zero);
+
+		_mm256_storeu_ps(pa + i, _mm256_add_ps(_mm256_loadu_ps(pa + i), h));
+	}
+#elif defined(PARTICLE_SIMD_SSE)
+	const __m128 h = _mm_set1_ps(dt);
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 u = _mm_loadu_ps(pvx + i);
+		__m128 v = _mm_loadu_ps(pvy + i);
+		__m128 w = _mm_loadu_ps(pvz + i);
+
+		// update position based on velocity
+		_mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(u, h)));
+		_mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(v, h)));
+		_mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(w, h)));
+
+		// a = f / m, then damp the new velocity
+		__m128 hm = _mm_div_ps(h, _mm_loadu_ps(pm + i));
+		__m128 d = _mm_loadu_ps(pd + i);
+		u = _mm_mul_ps(_mm_add_ps(u, _mm_mul_ps(_mm_loadu_ps(pfx + i), hm)), d);
+		v = _mm_mul_ps(_mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(pfy + i), hm)), d);
+		w = _mm_mul_ps(_mm_add_ps(w, _mm_mul_ps(_mm_loadu_ps(pfz + i), hm)), d);
+		_mm_storeu_ps(pvx + i, u);
+		_mm_storeu_ps(pvy + i, v);
+		_mm_storeu_ps(pvz + i, w);
+
+		// clear forces (they get re-added each step)
+		_mm_storeu_ps(pfx + i, zero);
+		_mm_storeu_ps(pfy + i, zero);
+		_mm_storeu_ps(pfz + i, zero);
+
+		_mm_storeu_ps(pa + i, _mm_add_ps(_mm_loadu_ps(pa + i), h));
+	}
+#endif
+
+	for (; i < n; i++) {
+		px[i] += pvx[i] * dt;
+		py[i] += pvy[i] * dt;
+		pz[i] += pvz[i] * dt;
+		float hm = dt / pm[i];
+		pvx[i] = (pvx[i] + pfx[i] * hm) * pd[i];
+		pvy[i] = (pvy[i] + pfy[i] * hm) * pd[i];
+		pvz[i] = (pvz[i] + pfz[i] * hm) * pd[i];
+		pfx[i] = 0;
+		pfy[i] = 0;
+		pfz[i] = 0;
+		pa[i] += dt;
+	}
+}
+
+// Plain scalar version of integrate(), kept as the reference the SIMD
+// kernel is benchmarked against
+//
+void ParticleStore::integrateScalar(float dt) {
+	for (int i = 0; i < size(); i++) {
+		x[i] += vx[i] * dt;
+		y[i] += vy[i] * dt;
+		z[i] += vz[i] * dt;
+		float hm = dt / mass[i];
+		vx[i] = (vx[i] + fx[i] * hm) * damping[i];
+		vy[i] = (vy[i] + fy[i] * hm) * damping[i];
+		vz[i] = (vz[i] + fz[i] * hm) * damping[i];
+		fx[i] = 0;
+		fy[i] = 0;
+		fz[i] = 0;
+		age[i] += dt;
+	}
+	version++;
+}
+
+/* Append the live part of every particle array to a snapshot */
+void ParticleStore::saveState(SimSnapshot &snap) {
+	snap.put(count);
+	forEachArray([&snap, this](vector<float> &a) { snap.putData(a.data(), count); });
+}
+
+/* Read back the arrays written by saveState */
+void ParticleStore::restoreState(SimSnapshot &snap) {
+	snap.get(count);
+	if (count > capacity()) setCapacity(count);
+	forEachArray([&snap, this](vector<float> &a) { snap.getData(a.data(), count); });
+	version++;
+}
+
+/* Heap memory held by the pool arrays, live and free slots alike */
+size_t ParticleStore::memoryBytes() const {
+	size_t bytes = dead.capacity();
+	forEachArray([&bytes](const vector<float> &a) { bytes += a.capacity() * sizeof(float); });
+	return bytes;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Particle.h"
+#include "Snapshot.h"
+
+// pick the widest SIMD instruction set the compiler targets
+//
+#if defined(__AVX__)
+#define PARTICLE_SIMD_AVX
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PARTICLE_SIMD_SSE
+#include <xmmintrin.h>
+#endif
+
+// what alloc() does when the pool has no free slots left
+//
+typedef enum { DropOldest, DropNew } ParticleOverflow;
+
+//  Struct-of-arrays particle storage.  Every particle attribute lives in
+//  its own contiguous array so the integration kernel can stream through
+//  them 4 (SSE) or 8 (AVX) particles at a time.  Particle is still used
+//  as the value type for adding and inspecting single particles.
+//
+//  Ages count simulation time, advanced by the same dt as the motion, so
+//  expiry follows pauses, fast-forward and headless runs and never reads
+//  the clock per particle.
+//
+//  The arrays are a fixed-capacity pool: they are allocated once by
+//  setCapacity() and live particles occupy slots [0, size()).  Spawning
+//  bumps size() into the free slots, so bursts never reallocate and the
+//  memory used is bounded by the capacity.
+//
+class ParticleStore {
+public:
+	void setCapacity(int n);
+	int capacity() const { return (int)x.size(); }
+	void setOverflow(ParticleOverflow o) { overflow = o; }
+	int alloc(int n);
+	void add(const Particle &p);
+	Particle get(int i) const;
+	void remove(int i);
+	int removeExpired();
+	int removeNear(const ofVec3f &point, float dist);
+	int compact();
+	int cullOldest(int n);
+	void clear();
+	int size() const { return count; }
+	void integrate(float dt);
+	void integrate(int begin, int end, float dt);
+	void integrateScalar(float dt);
+	void saveState(SimSnapshot &snap);
+	void restoreState(SimSnapshot &snap);
+	size_t memoryBytes() const;
+	void touch() { version++; }
+
+	// position
+	vector<float> x, y, z;
+
+	// velocity
+	vector<float> vx, vy, vz;
+
+	// accumulated forces, cleared by integrate()
+	vector<float> fx, fy, fz;
+
+	vector<float> mass;
+	vector<float> damping;
+	vector<float> radius;
+	vector<float> lifespan;   // sec
+	vector<float> age;        // sec alive, advanced by integrate()
+
+	// per-particle flags marking particles for removal by compact()
+	vector<uint8_t> dead;
+
+	int count = 0;            // live particles
+	int highWater = 0;        // most particles alive at once
+	int dropped = 0;          // particles lost to overflow
+
+	// bumped by every change to which slots are live or what they hold,
+	// so anything indexed by slot (the spatial hash) can tell it is stale.
+	// integrate(begin, end) leaves it alone, its chunks run in parallel;
+	// callers integrating ranges or writing slots directly call touch()
+	uint64_t version = 0;
+	ParticleOverflow overflow = DropOldest;
+
+	static const int defaultCapacity = 10000;
+
+private:
+	void dropFront(int n);
+
+	// call f on every per-particle float array
+	template <typename F> void forEachArray(F f) {
+		f(x); f(y); f(z);
+		f(vx); f(vy); f(vz);
+		f(fx); f(fy); f(fz);
+		f(mass);
+		f(damping);
+		f(radius);
+		f(lifespan);
+		f(age);
+	}
+	template <typename F> void forEachArray(F f) const {
+		f(x); f(y); f(z);
+		f(vx); f(vy); f(vz);
+		f(fx); f(fy); f(fz);
+		f(mass);
+		f(damping);
+		f(radius);
+		f(lifespan);
+		f(age);
+	}
+};
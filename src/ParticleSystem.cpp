@@ -2,92 +2,188 @@
 // Kevin M.Smith - CS 134 SJSU
 
 #include "ParticleSystem.h"
+#include "WorkerPool.h"
 
 /* Add particle to system */
 void ParticleSystem::add(const Particle &p) {
-	particles.push_back(p);
+	particles.add(p);
+	gridValid = false;
 }
 
 /* Add force to system */
-void ParticleSystem::addForce(ParticleForce *f) {
+void ParticleSystem::addForce(shared_ptr<ParticleForce> f) {
 	forces.push_back(f);
 }
 
 /* Remove particle */
 void ParticleSystem::remove(int i) {
-	particles.erase(particles.begin() + i);
+	particles.remove(i);
+	gridValid = false;
 }
 
 /* Set lifespan of particles */
 void ParticleSystem::setLifespan(float l) {
 	for (int i = 0; i < particles.size(); i++) {
-		particles[i].lifespan = l;
+		particles.lifespan[i] = l;
 	}
 }
 
 /* Reset system */
 void ParticleSystem::reset() {
-	for (int i = 0; i < forces.size(); i++) {
+	for (int i = 0; i < (int)forces.size(); i++) {
 		forces[i]->applied = false;
 	}
 }
 
-/* Update system */
-void ParticleSystem::update() {
+/* Update system, advancing it by "dt" seconds of simulation time */
+void ParticleSystem::update(float dt) {
+	gridValid = false;
+
 	// check if empty and just return
 	if (particles.size() == 0) return;
 
-	vector<Particle>::iterator p = particles.begin();
-	vector<Particle>::iterator tmp;
-
 	// check which particles have exceed their lifespan and delete
-	// from list.  When deleting multiple objects from a vector while
-	// traversing at the same time, we need to use an iterator.
+	// them from the store in a single compaction pass.
 	//
-	while (p != particles.end()) {
-		if (p->lifespan != -1 && p->age() > p->lifespan) {
-			tmp = particles.erase(p);
-			p = tmp;
-		}
-		else p++;
-	}
+	particles.removeExpired();
+
+	collisions = 0;
+	collideMicros = 0;
+	step(dt, 0, particles.size());
+	endStep();
+}
+
+// Advance particles [begin, end) by "dt": forces, terrain collision and
+// integration, without expiry.  Emitters that keep their particles in a
+// ring call this once per contiguous part of the ring and then endStep()
+// once for the frame.  Collision stats add up over the calls.
+//
+void ParticleSystem::step(float dt, int begin, int end) {
+	gridValid = false;
+	if (end <= begin) return;
+
+	WorkerPool &pool = WorkerPool::shared();
+	uint64_t frameSeed = (seed + frame) * 0x9E3779B97F4A7C15ULL;
+	int n = end - begin;
 
-	// update forces on all particles first 
+	// update forces on all particles first, in parallel chunks.  Each
+	// force is applied to a whole chunk at a time, and each chunk draws
+	// its random numbers from the stream of its first particle.
 	//
-	for (int i = 0; i < particles.size(); i++) {
-		for (int k = 0; k < forces.size(); k++) {
+	pool.parallelFor(n, grain, [&](int b, int e, int) {
+		uint64_t stream = begin + b;
+		particleRng().seed(frameSeed, stream);
+		particleRngLanes().seed(frameSeed, stream);
+		for (int k = 0; k < (int)forces.size(); k++) {
 			if (!forces[k]->applied)
-				forces[k]->updateForce( &particles[i] );
+				forces[k]->apply(particles, begin + b, begin + e);
 		}
+	});
+
+	// collide this step's motion with the terrain, when there is one
+	//
+	if (collision.terrain) {
+		uint64_t start = ofGetElapsedTimeMicros();
+		std::atomic<int> hits(0);
+		pool.parallelFor(n, grain, [&](int b, int e, int) {
+			hits += collision.collide(particles, begin + b, begin + e, dt);
+		});
+		collisions += hits;
+		collideMicros += ofGetElapsedTimeMicros() - start;
 	}
 
-	// update all forces only applied once to "applied"
-	// so they are not applied again.
+	// integrate the particles, in parallel chunks
 	//
-	for (int i = 0; i < forces.size(); i++) {
+	pool.parallelFor(n, grain, [&](int b, int e, int) {
+		particles.integrate(begin + b, begin + e, dt);
+	});
+	particles.touch();
+}
+
+// finish the frame started by step(): forces only applied once are
+// marked "applied" so they are not applied again, and the random
+// streams move on to the next frame
+//
+void ParticleSystem::endStep() {
+	for (int i = 0; i < (int)forces.size(); i++) {
 		if (forces[i]->applyOnce)
 			forces[i]->applied = true;
 	}
+	frame++;
+}
 
-	// integrate all the particles in the store
-	//
-	for (int i = 0; i < particles.size(); i++)
-		particles[i].integrate();
-
+// remove all particlies within "dist" of point, return number removed.
+// The spatial hash finds them, and one compaction pass removes them.
+//
+int ParticleSystem::removeNear(const ofVec3f & point, float dist) {
+	ParticleGrid &g = neighbors();
+	std::fill(particles.dead.begin(), particles.dead.begin() + particles.size(), 0);
+	g.forEachNear(point, dist, [this](int i) { particles.dead[i] = 1; });
+	int removed = particles.compact();
+	if (removed > 0) gridValid = false;
+	return removed;
 }
 
-// remove all particlies within "dist" of point (not implemented as yet)
+// spatial hash of the current particle positions, for radius queries and
+// neighbor iteration.  Built on first use after each step.
 //
-int ParticleSystem::removeNear(const ofVec3f & point, float dist) { return 0; }
+ParticleGrid &ParticleSystem::neighbors() {
+	if (!gridValid || gridVersion != particles.version) {
+		grid.build(particles);
+		gridValid = true;
+		gridVersion = particles.version;
+	}
+	return grid;
+}
 
 //  draw the particle cloud
 //
 void ParticleSystem::draw() {
 	for (int i = 0; i < particles.size(); i++) {
-		particles[i].draw();
+		ofSetColor(ofMap(particles.age[i], 0, particles.lifespan[i], 255, 10), 0, 0);
+		ofDrawSphere(ofVec3f(particles.x[i], particles.y[i], particles.z[i]), particles.radius[i]);
+	}
+}
+
+
+// append particles and force state to a snapshot
+//
+void ParticleSystem::saveState(SimSnapshot &snap) {
+	particles.saveState(snap);
+	snap.put(frame);
+	for (int i = 0; i < (int)forces.size(); i++) {
+		snap.put(forces[i]->applied);
+	}
+}
+
+// read back the state written by saveState
+//
+void ParticleSystem::restoreState(SimSnapshot &snap) {
+	particles.restoreState(snap);
+	gridValid = false;
+	snap.get(frame);
+	for (int i = 0; i < (int)forces.size(); i++) {
+		snap.get(forces[i]->applied);
 	}
 }
 
+/* Heap memory held by the particles and the spatial hash */
+size_t ParticleSystem::memoryBytes() const {
+	return particles.memoryBytes() + grid.memoryBytes();
+}
+
+// Default batched force: gather each particle, let the per-particle
+// updateForce() add to it and write the accumulated force back
+//
+void ParticleForce::apply(ParticleStore &ps, int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		Particle p = ps.get(i);
+		updateForce(&p);
+		ps.fx[i] = p.forces.x;
+		ps.fy[i] = p.forces.y;
+		ps.fz[i] = p.forces.z;
+	}
+}
 
 // Gravity Force Field 
 //
@@ -102,6 +198,17 @@ void GravityForce::updateForce(Particle * particle) {
 	particle->forces += gravity * particle->mass;
 }
 
+void GravityForce::apply(ParticleStore &ps, int begin, int end) {
+	float *fx = ps.fx.data(), *fy = ps.fy.data(), *fz = ps.fz.data();
+	const float *m = ps.mass.data();
+	float gx = gravity.x, gy = gravity.y, gz = gravity.z;
+	for (int i = begin; i < end; i++) {
+		fx[i] += gx * m[i];
+		fy[i] += gy * m[i];
+		fz[i] += gz * m[i];
+	}
+}
+
 // Turbulence Force Field 
 //
 TurbulenceForce::TurbulenceForce(const ofVec3f &min, const ofVec3f &max) {
@@ -114,9 +221,52 @@ void TurbulenceForce::updateForce(Particle * particle) {
 	// We are going to add a little "noise" to a particles
 	// forces to achieve a more natual look to the motion
 	//
-	particle->forces.x += ofRandom(tmin.x, tmax.x);
-	particle->forces.y += ofRandom(tmin.y, tmax.y);
-	particle->forces.z += ofRandom(tmin.z, tmax.z);
+	Rng &rng = particleRng();
+	particle->forces.x += rng.uniform(tmin.x, tmax.x);
+	particle->forces.y += rng.uniform(tmin.y, tmax.y);
+	particle->forces.z += rng.uniform(tmin.z, tmax.z);
+}
+
+void TurbulenceForce::apply(ParticleStore &ps, int begin, int end) {
+	// draw all the noise for the range in three batches, then add it
+	int n = end - begin;
+	vector<float> &noise = particleScratch(3 * n);
+	RngLanes &rng = particleRngLanes();
+	rng.fill(&noise[0], n, tmin.x, tmax.x);
+	rng.fill(&noise[n], n, tmin.y, tmax.y);
+	rng.fill(&noise[2 * n], n, tmin.z, tmax.z);
+
+	float *fx = ps.fx.data() + begin, *fy = ps.fy.data() + begin, *fz = ps.fz.data() + begin;
+	const float *nx = &noise[0], *ny = &noise[n], *nz = &noise[2 * n];
+	for (int i = 0; i < n; i++) {
+		fx[i] += nx[i];
+		fy[i] += ny[i];
+		fz[i] += nz[i];
+	}
+}
+
+// Curl Noise Force Field - a 32^3 field tiling every 32 * cellSize units,
+// generated once (or read from "cachePath" when given).  32 points per
+// tile keep the steps between nearest points small next to the field's
+// waves, and packed 8-bit cells keep it small enough (128 KB) to stay in
+// cache while sampling
+//
+CurlNoiseForce::CurlNoiseForce(float magnitude, float cellSize, const string &cachePath) {
+	this->magnitude = magnitude;
+	field.cellSize = cellSize;
+	field.generateOrLoad(cachePath, 32, 1);
+}
+
+void CurlNoiseForce::updateForce(Particle * particle) {
+	ofVec3f f(0, 0, 0);
+	field.sample(&particle->position.x, &particle->position.y, &particle->position.z, 1,
+		magnitude, &f.x, &f.y, &f.z);
+	particle->forces += f;
+}
+
+void CurlNoiseForce::apply(ParticleStore &ps, int begin, int end) {
+	field.sample(ps.x.data() + begin, ps.y.data() + begin, ps.z.data() + begin, end - begin,
+		magnitude, ps.fx.data() + begin, ps.fy.data() + begin, ps.fz.data() + begin);
 }
 
 // Impulse Radial Force - this is a "one shot" force that
@@ -132,6 +282,23 @@ void ImpulseRadialForce::updateForce(Particle * particle) {
 	// we basically create a random direction for each particle
 	// the force is only added once after it is triggered.
 	//
-	ofVec3f dir = ofVec3f(ofRandom(-1, 1), ofRandom(-1, 1), ofRandom(-1, 1));
+	Rng &rng = particleRng();
+	ofVec3f dir = ofVec3f(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1));
 	particle->forces += dir.getNormalized() * magnitude;
+}
+
+void ImpulseRadialForce::apply(ParticleStore &ps, int begin, int end) {
+	// random directions for the whole range in one batch
+	int n = end - begin;
+	vector<float> &dir = particleScratch(3 * n);
+	particleRngLanes().fill(&dir[0], 3 * n, -1, 1);
+
+	float *fx = ps.fx.data() + begin, *fy = ps.fy.data() + begin, *fz = ps.fz.data() + begin;
+	const float *dx = &dir[0], *dy = &dir[n], *dz = &dir[2 * n];
+	for (int i = 0; i < n; i++) {
+		float s = magnitude / sqrt(dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i]);
+		fx[i] += dx[i] * s;
+		fy[i] += dy[i] * s;
+		fz[i] += dz[i] * s;
+	}
 }
\ No newline at end of file
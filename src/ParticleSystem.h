@@ -3,30 +3,74 @@
 
 #include "ofMain.h"
 #include "Particle.h"
+#include "ParticleStore.h"
+#include "ParticleGrid.h"
+#include "ParticleCollision.h"
+#include "Snapshot.h"
+#include "Rng.h"
+#include "CurlNoise.h"
 
 
 //  Pure Virtual Function Class - must be subclassed to create new forces.
 //
+//  apply() adds the force to a whole range of particles in the store with
+//  one virtual call.  The default gathers each particle and calls the
+//  per-particle updateForce(), so existing forces keep working; the
+//  built-in forces override apply() with tight loops over the arrays.
+//
 class ParticleForce {
 protected:
 public:
 	bool applyOnce = false;
 	bool applied = false;
 	virtual void updateForce(Particle *) = 0;
+	virtual void apply(ParticleStore &ps, int begin, int end);
 };
 
 class ParticleSystem {
 public:
 	void add(const Particle &);
-	void addForce(ParticleForce *);
+	void addForce(shared_ptr<ParticleForce> f);
 	void remove(int);
-	void update();
+	void update(float dt);
+	void step(float dt, int begin, int end);
+	void endStep();
 	void setLifespan(float);
 	void reset();
 	int removeNear(const ofVec3f & point, float dist);
+	ParticleGrid &neighbors();
+	void setTerrain(const Octree *terrain) { collision.terrain = terrain; }
+	void setTransform(const glm::mat4 &m) { collision.setTransform(m); }
 	void draw();
-	vector<Particle> particles;
-	vector<ParticleForce *> forces;
+	void setSeed(uint64_t s) { seed = s; frame = 0; }
+	void saveState(SimSnapshot &snap);
+	void restoreState(SimSnapshot &snap);
+	size_t memoryBytes() const;
+	ParticleStore particles;
+
+	// forces are shared: one force object can act on several systems
+	// and lives as long as the last system using it
+	vector<shared_ptr<ParticleForce>> forces;
+
+	// random numbers for the chunk starting at particle i come from
+	// (seed, frame, i), so a fixed seed gives the same result on any
+	// number of threads
+	uint64_t seed = 0;
+	uint64_t frame = 0;
+	int grain = 2048;     // particles per parallel chunk
+
+	// spatial hash over the particles, rebuilt by neighbors() at most
+	// once per step and only when something asks for it.  It is also
+	// stale once the store's version moves past gridVersion, which
+	// catches changes made on the store directly
+	ParticleGrid grid;
+	bool gridValid = false;
+	uint64_t gridVersion = 0;
+
+	// optional terrain collision, run between forces and integration
+	ParticleCollision collision;
+	int collisions = 0;           // particles that hit the terrain last step
+	uint64_t collideMicros = 0;   // time the collision stage took last step
 };
 
 
@@ -38,6 +82,7 @@ class GravityForce: public ParticleForce {
 public:
 	GravityForce(const ofVec3f & gravity);
 	void updateForce(Particle *);
+	void apply(ParticleStore &ps, int begin, int end);
 };
 
 class TurbulenceForce : public ParticleForce {
@@ -45,6 +90,19 @@ class TurbulenceForce : public ParticleForce {
 public:
 	TurbulenceForce(const ofVec3f & min, const ofVec3f &max);
 	void updateForce(Particle *);
+	void apply(ParticleStore &ps, int begin, int end);
+};
+
+// Smooth turbulence: particles are pushed along a precomputed curl-noise
+// flow, so neighbors move together instead of jittering independently
+//
+class CurlNoiseForce : public ParticleForce {
+	float magnitude;
+public:
+	CurlNoiseForce(float magnitude, float cellSize = 4, const string &cachePath = "");
+	void updateForce(Particle *);
+	void apply(ParticleStore &ps, int begin, int end);
+	CurlNoiseField field;
 };
 
 class ImpulseRadialForce : public ParticleForce {
@@ -52,4 +110,5 @@ class ImpulseRadialForce : public ParticleForce {
 public:
 	ImpulseRadialForce(float magnitude); 
 	void updateForce(Particle *);
+	void apply(ParticleStore &ps, int begin, int end);
 };
@@ -0,0 +1,48 @@
+#include "ParticleSystemPool.h"
+
+/* Pool shared by every emitter that does not bring its own system */
+ParticleSystemPool &ParticleSystemPool::shared() {
+	static ParticleSystemPool pool;
+	return pool;
+}
+
+/* Hand out an idle system, creating one only when none is left */
+ParticleSystem *ParticleSystemPool::acquire() {
+	if (!idle.empty()) {
+		ParticleSystem *s = idle.back();
+		idle.pop_back();
+		return s;
+	}
+	systems.push_back(unique_ptr<ParticleSystem>(new ParticleSystem()));
+	return systems.back().get();
+}
+
+// Take a system back.  Its particles, forces and terrain are dropped and
+// the store and collision settings go back to their defaults, so the next
+// owner starts from a clean system.  The store goes back to no capacity,
+// like a new one, so its first alloc() applies defaultCapacity; shrinking
+// only resizes the arrays, which keep their memory for reuse.
+//
+void ParticleSystemPool::release(ParticleSystem *s) {
+	if (s == NULL) return;
+	ParticleStore &ps = s->particles;
+	ps.clear();
+	ps.setCapacity(0);
+	ps.setOverflow(DropOldest);
+	ps.highWater = 0;
+	ps.dropped = 0;
+	s->forces.clear();
+	s->collision = ParticleCollision();
+	s->setSeed(0);
+	s->gridValid = false;
+	s->collisions = 0;
+	s->collideMicros = 0;
+	idle.push_back(s);
+}
+
+/* Heap memory held by all pooled systems, in use or idle */
+size_t ParticleSystemPool::memoryBytes() const {
+	size_t bytes = 0;
+	for (const auto &s : systems) bytes += sizeof(ParticleSystem) + s->memoryBytes();
+	return bytes;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ParticleSystem.h"
+
+//  Recycles particle systems between emitters.  An emitter acquires a
+//  system when it is created and releases it when it is destroyed; the
+//  released system is emptied but keeps its allocated arrays, so the
+//  next emitter reuses the memory instead of allocating again.  Spawning
+//  and destroying vehicles therefore never grows memory beyond the most
+//  systems alive at once.
+//
+class ParticleSystemPool {
+public:
+	ParticleSystem *acquire();
+	void release(ParticleSystem *s);
+	int created() const { return (int)systems.size(); }
+	int available() const { return (int)idle.size(); }
+	size_t memoryBytes() const;
+
+	static ParticleSystemPool &shared();
+
+private:
+	vector<unique_ptr<ParticleSystem>> systems;   // every system the pool owns
+	vector<ParticleSystem *> idle;                // released, ready for reuse
+};
@@ -3,6 +3,8 @@
 #include "Shape.h"
 #include "ofxAssimpModelLoader.h"
 #include "ParticleEmitter.h"
+#include "ThrustPlume.h"
+#include "DebrisBatch.h"
 #include "vector3.h"
 #include "box.h"
 
@@ -27,16 +29,14 @@ public:
 		speed = 200.0f;
 		torque = 100.f;
 
-		// First initialize emitter.sys to make sure it exists before adding forces
-		emitter.sys = new ParticleSystem();
-
 		/* Emitter and Particles */
-		// then set up the emitter forces
-		turbForce = new TurbulenceForce(ofVec3f(-20, -20, -20), ofVec3f(20, 20, 20));
-		gravityForce = new GravityForce(ofVec3f(0, -1.62f, 0));
-		radialForce = new ImpulseRadialForce(100);
+		// the emitters take their systems from the shared pool; turbulence
+		// and gravity are shared with every other lander, the explosion
+		// impulse is this lander's own
+		turbForce = sharedTurbulence();
+		gravityForce = sharedGravity();
+		radialForce = make_shared<ImpulseRadialForce>(100);
 
-		// Now add forces to the properly initialized system
 		emitter.sys->addForce(turbForce);
 		emitter.sys->addForce(gravityForce);
 		emitter.sys->addForce(radialForce);
@@ -47,40 +47,71 @@ public:
 		emitter.setOneShot(true);
 		emitter.setEmitterType(RadialEmitter);
 		emitter.setGroupSize(10000);
+		emitter.setCapacity(10000);
+		emitter.setSeed(1);
+		emitter.setDepthSort(true);
 		emitter.visible = true;
 
-		/* Thrust Disk Emitter */
-		diskEmitter.sys = new ParticleSystem();
-		diskEmitter.sys->addForce(gravityForce);
+		/* Thrust Plume */
+		thrust.sys->addForce(gravityForce);
 
 		// set up emitter
-		diskEmitter.speed = 50;
-		diskEmitter.torque = torque;
-		diskEmitter.mass = 10;
+		thrust.speed = 50;
+		thrust.torque = torque;
+		thrust.mass = 10;
 
-		diskEmitter.radius = 2;
+		thrust.radius = 2;
 
-		diskEmitter.setPosition(glm::vec3(pos.x, pos.y-95, pos.z));
-		diskEmitter.setVelocity(velocity);
-		diskEmitter.acceleration = acceleration;
-		diskEmitter.forces = forces;
+		thrust.setPosition(glm::vec3(pos.x, pos.y-95, pos.z));
+		thrust.setVelocity(velocity);
+		thrust.acceleration = acceleration;
+		thrust.forces = forces;
 
 
-		diskEmitter.rot = rot;
-		diskEmitter.angVelocity = angVelocity;
-		diskEmitter.angAcceleration = angAcceleration;
-		diskEmitter.rotForces = rotForces;
+		thrust.rot = rot;
+		thrust.angVelocity = angVelocity;
+		thrust.angAcceleration = angAcceleration;
+		thrust.rotForces = rotForces;
 
-		diskEmitter.setOneShot(true);
-		diskEmitter.setEmitterType(DiskEmitter);
-		diskEmitter.setGroupSize(1000);
-		diskEmitter.setParticleRadius(1);
-		diskEmitter.visible = true;
+		// a steady flow of up to 1000 particles/sec instead of a burst
+		// of 1000 each time the engine lights
+		thrust.setLifespan(3);
+		thrust.setMaxRate(1000);
+		thrust.setSeed(2);
+		thrust.setParticleRadius(1);
+		thrust.visible = true;
 
 		// visibility: true if hasnt collided, otherwise false
 		visible = true;
 	}
 
+	/* Curl-noise turbulence shared by all landers, freed with the last one */
+	static shared_ptr<CurlNoiseForce> sharedTurbulence() {
+		static weak_ptr<CurlNoiseForce> shared;
+		shared_ptr<CurlNoiseForce> f = shared.lock();
+		if (!f) {
+			f = make_shared<CurlNoiseForce>(20, 4, ofToDataPath("curlnoise.bin"));
+			shared = f;
+		}
+		return f;
+	}
+
+	/* Lunar gravity on particles, shared by all landers */
+	static shared_ptr<GravityForce> sharedGravity() {
+		static weak_ptr<GravityForce> shared;
+		shared_ptr<GravityForce> f = shared.lock();
+		if (!f) {
+			f = make_shared<GravityForce>(ofVec3f(0, -1.62f, 0));
+			shared = f;
+		}
+		return f;
+	}
+
+	/* Heap and GPU memory held by this lander's particle effects */
+	size_t memoryBytes() const {
+		return emitter.memoryBytes() + thrust.memoryBytes();
+	}
+
 	float getFuelPercentage() {
 		return fuel / maxFuel;
 	}
@@ -93,7 +124,7 @@ public:
 			lander.drawFaces();
 		}
 		emitter.draw();
-		diskEmitter.draw();
+		thrust.draw();
 		ofPopMatrix();
 
 	}
@@ -115,19 +146,41 @@ public:
 	/* Set player visibility */
 	void setVisible(bool state) {
 		visible = state;
-		diskEmitter.visible = state;
+		thrust.visible = state;
 	}
 
-	/* Simulate a collision */
-	void breakPlayer() {
+	/* Simulate a collision, with rigid debris instead of particles if given a batch */
+	void breakPlayer(DebrisBatch *debris = NULL) {
 		cout << "breakPlayer" << endl;
 		setVisible(false);
+		if (debris) {
+			debris->explode(pos, rot, glm::vec3(velocity.x, velocity.y, velocity.z), 8);
+			return;
+		}
 		ofVec3f center = getCenter();
 		emitter.setPosition(glm::vec3(center.x, center.y - 100, center.z));
 		emitter.sys->reset();
 		emitter.start();
 	}
 
+	/* Append player, fuel and emitter state to a snapshot */
+	void saveState(SimSnapshot &snap) {
+		DynamicShape::saveState(snap);
+		snap.put(fuel);
+		snap.put(visible);
+		emitter.saveState(snap);
+		thrust.saveState(snap);
+	}
+
+	/* Read back the state written by saveState */
+	void restoreState(SimSnapshot &snap) {
+		DynamicShape::restoreState(snap);
+		snap.get(fuel);
+		snap.get(visible);
+		emitter.restoreState(snap);
+		thrust.restoreState(snap);
+	}
+
 	void setPosition(float x, float y, float z) {
 		pos = glm::vec3(x, y, z);
 		ofVec3f center = getCenter();
@@ -138,26 +191,36 @@ public:
 		return pos;
 	}
 
-	/* Move the player with physics */
-	void update() {
-		if (ofGetFrameRate() != 0) {
-			integrate();
+	/* Move the player with physics, "dt" seconds of simulation time */
+	void update(float dt) {
+		if (dt > 0) {
+			// batched players are integrated by their VehicleBatch,
+			// sleeping players are not integrated at all
+			if (!isBatched() && !isAsleep()) integrate();
 			ofVec3f center = getCenter();
 
+			// the particles are drawn under the lander's transform, so
+			// their terrain collision has to go through it too
+			glm::mat4 m = getTransform();
+			emitter.sys->setTransform(m);
+			thrust.sys->setTransform(m);
+
 			/* Collision Radial Emitter */
 			// spawn particles accordingly
-			emitter.update();
+			emitter.update(dt);
 
-			/* Thrust Disk Emitter */
+			/* Thrust Plume */
 
 			// emitter movement
-			diskEmitter.forces = forces;
-			diskEmitter.rotForces = rotForces;
-			diskEmitter.integrate();
+			if (!isAsleep()) {
+				thrust.forces = forces;
+				thrust.rotForces = rotForces;
+				thrust.integrate();
+			}
 
 			// spawn particles accordingly
 			if (visible) {
-				diskEmitter.update();
+				thrust.update(dt);
 			}
 		}
 	}
@@ -178,8 +241,8 @@ public:
 	bool visible;
 
 	ParticleEmitter emitter;
-	ParticleEmitter diskEmitter;
-	TurbulenceForce* turbForce;
-	GravityForce* gravityForce;
-	ImpulseRadialForce* radialForce;
+	ThrustPlume thrust;
+	shared_ptr<CurlNoiseForce> turbForce;
+	shared_ptr<GravityForce> gravityForce;
+	shared_ptr<ImpulseRadialForce> radialForce;
 };
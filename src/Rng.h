@@ -0,0 +1,123 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Small, fast PCG32 random number generator for single numbers.  Unlike ofRandom it has no
+//  global state, so every thread or chunk of particle work can own one and
+//  get the same numbers back from the same explicit seed.
+//
+class Rng {
+public:
+	Rng(uint64_t s = 0, uint64_t stream = 0) { seed(s, stream); }
+
+	/* Restart the sequence from seed "s" */
+	void seed(uint64_t s, uint64_t stream = 0) {
+		state = 0;
+		inc = (stream << 1) | 1;
+		next();
+		state += s;
+		next();
+	}
+
+	/* Next 32 random bits */
+	uint32_t next() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+		uint32_t rot = (uint32_t)(old >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+	}
+
+	/* Uniform float in [0, 1) */
+	float uniform() {
+		return (next() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	/* Uniform float in [min, max) */
+	float uniform(float min, float max) {
+		return min + (max - min) * uniform();
+	}
+
+	uint64_t state;
+	uint64_t inc;
+};
+
+//  Eight independent xoshiro128+ generators kept side by side.  fill()
+//  steps all eight lanes together with the same instructions, so the
+//  compiler turns it into SIMD code and whole arrays of random floats are
+//  produced at a fraction of the cost of one call per number.
+//
+class RngLanes {
+public:
+	static const int lanes = 8;
+
+	RngLanes(uint64_t s = 0) { seed(s); }
+
+	/* Restart all lanes from seed "s", each lane on its own sequence */
+	void seed(uint64_t s, uint64_t stream = 0) {
+		Rng init(s, stream);
+		for (int l = 0; l < lanes; l++) {
+			s0[l] = init.next();
+			s1[l] = init.next();
+			s2[l] = init.next();
+			s3[l] = init.next() | 1;    // state must never be all zero
+		}
+	}
+
+	/* Fill out[0..n) with uniform floats in [min, max) */
+	void fill(float *out, int n, float min, float max) {
+		float scale = (max - min) * (1.0f / 16777216.0f);
+		int i = 0;
+		for (; i + lanes <= n; i += lanes) {
+			step(out + i, min, scale);
+		}
+		if (i < n) {
+			float rest[lanes];
+			step(rest, min, scale);
+			for (int l = 0; i < n; i++, l++) out[i] = rest[l];
+		}
+	}
+
+	uint32_t s0[lanes], s1[lanes], s2[lanes], s3[lanes];
+
+private:
+	// advance every lane once, writing one float per lane
+	void step(float *out, float min, float scale) {
+		for (int l = 0; l < lanes; l++) {
+			uint32_t result = s0[l] + s3[l];
+			uint32_t t = s1[l] << 9;
+			s2[l] ^= s0[l];
+			s3[l] ^= s1[l];
+			s1[l] ^= s2[l];
+			s0[l] ^= s3[l];
+			s2[l] ^= t;
+			s3[l] = (s3[l] << 11) | (s3[l] >> 21);
+			out[l] = min + (result >> 8) * scale;
+		}
+	}
+};
+
+// generator for particle work running on the current thread.  Parallel
+// loops seed it at the start of every chunk so results do not depend on
+// which thread ran the chunk.
+//
+inline Rng &particleRng() {
+	thread_local Rng rng;
+	return rng;
+}
+
+// batch generator for particle work running on the current thread,
+// seeded per chunk alongside particleRng()
+//
+inline RngLanes &particleRngLanes() {
+	thread_local RngLanes rng;
+	return rng;
+}
+
+// per-thread scratch space for batches of random numbers
+//
+inline vector<float> &particleScratch(int n) {
+	thread_local vector<float> scratch;
+	if ((int)scratch.size() < n) scratch.resize(n);
+	return scratch;
+}
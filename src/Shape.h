@@ -1,6 +1,8 @@
 #pragma once
 
 #include "ofMain.h"
+#include "VehicleBatch.h"
+#include "Snapshot.h"
 
 
 //--------------------------------------------------------------
@@ -70,18 +72,102 @@ public:
 		angVelocity = 0;
 		angAcceleration = 0;
 		rotForces = 0;
+
+		// adaptive substepping
+		substeps = 1;
+		maxSubsteps = 8;
+		substepClearance = 0.25f;
+		substepMinTravel = 0.5f;
+		substepMaxTravel = 5.0f;
+
+		// rest detection
+		asleep = false;
+		restFrames = 0;
+		sleepVelocity = 0.5f;
+		sleepAngVelocity = 0.5f;
+		sleepFrames = 30;
+
+		// batched integration (none until attached)
+		batch = nullptr;
+		batchSlot = -1;
+	}
+
+	/* Hand this shape's integration over to a shared VehicleBatch */
+	void attachBatch(VehicleBatch *b) {
+		batch = b;
+		batchSlot = batch->add(*this);
+	}
+
+	/* Return true if this shape is integrated by a VehicleBatch */
+	bool isBatched() {
+		return batch != nullptr;
 	}
 
-	/* Update position, velocity, and acceleration with Euler's method */
+	/* Copy state and accumulated forces into the batch before it integrates */
+	void pushState() {
+		if (batch) batch->load(batchSlot, *this);
+	}
+
+	/* Copy the integrated state back out of the batch */
+	void pullState() {
+		if (batch) batch->store(batchSlot, *this);
+	}
+
+	/* Append transform and motion state to a snapshot */
+	void saveState(SimSnapshot &snap) {
+		snap.put(pos);
+		snap.put(rot);
+		snap.put(velocity);
+		snap.put(acceleration);
+		snap.put(forces);
+		snap.put(angVelocity);
+		snap.put(angAcceleration);
+		snap.put(rotForces);
+		snap.put(asleep);
+		snap.put(restFrames);
+	}
+
+	/* Read back the state written by saveState */
+	void restoreState(SimSnapshot &snap) {
+		snap.get(pos);
+		snap.get(rot);
+		snap.get(velocity);
+		snap.get(acceleration);
+		snap.get(forces);
+		snap.get(angVelocity);
+		snap.get(angAcceleration);
+		snap.get(rotForces);
+		snap.get(asleep);
+		snap.get(restFrames);
+	}
+
+	/* Update position, velocity, and acceleration with Euler's method,
+	   split into "substeps" equal steps */
 	void integrate() {
 
 		/* Gravity */
 		forces += gravityForce();
 
-		/* Linear integration */
-
-		// interval for this step
+		// interval for this frame and for each substep
 		float dt = 1.0 / ofGetFrameRate();
+		float h = dt / substeps;
+
+		// spread the per-frame damping evenly over the substeps
+		float d = pow(damping, 1.0f / substeps);
+
+		for (int i = 0; i < substeps; i++) {
+			step(h, d);
+		}
+
+		// clear forces on particle (they get re-added each step)
+		forces.set(0, 0, 0);
+		rotForces = 0;
+	}
+
+	/* Advance one Euler step of length dt with damping factor d */
+	void step(float dt, float d) {
+
+		/* Linear integration */
 
 		// update position based on velocity
 		pos += (velocity * dt);
@@ -92,7 +178,7 @@ public:
 		velocity += accel * dt; // constant for faster decelerations 0.3
 
 		// add damping
-		velocity *= damping; // constant for faster decelerations 0.8
+		velocity *= d; // constant for faster decelerations 0.8
 
 		/* Angular integration */
 
@@ -105,12 +191,56 @@ public:
 		angVelocity += rotAccel * dt;
 
 		// add damping
-		angVelocity *= damping;  // constant for faster decelerations 0.8
+		angVelocity *= d;  // constant for faster decelerations 0.8
+	}
 
-		// clear forces on particle (they get re-added each step)
-		forces.set(0, 0, 0);
-		rotForces = 0;
+	/* Choose how many substeps the next frame needs.  A substep may not
+	   travel further than a fraction of the clearance to the terrain
+	   (altitude, -1 if unknown) or substepMaxTravel, so the step is
+	   subdivided when the shape is fast or close to the ground and stays
+	   a single step when it is high and slow */
+	void updateSubsteps(float altitude, float dt) {
+		float travel = velocity.length() * dt;
+		float maxTravel = substepMaxTravel;
+		if (altitude >= 0) {
+			maxTravel = ofClamp(altitude * substepClearance, substepMinTravel, substepMaxTravel);
+		}
+		int n = (int)ceil(travel / maxTravel);
+		substeps = (int)ofClamp(n, 1, maxSubsteps);
+	}
 
+	/* Track how long the shape has been resting on something and put it to
+	   sleep once it has been slow and in contact for sleepFrames frames */
+	void updateRest(bool inContact) {
+		bool resting = inContact &&
+			velocity.length() < sleepVelocity &&
+			abs(angVelocity) < sleepAngVelocity;
+		if (!resting) {
+			restFrames = 0;
+			return;
+		}
+		if (!asleep && ++restFrames >= sleepFrames) {
+			asleep = true;
+			velocity.set(0, 0, 0);
+			angVelocity = 0;
+		}
+	}
+
+	/* Wake a sleeping shape so it is integrated and collided again */
+	void wake() {
+		asleep = false;
+		restFrames = 0;
+	}
+
+	/* Return true if the shape is at rest and skipped by physics */
+	bool isAsleep() {
+		return asleep;
+	}
+
+	/* Add an external force, waking the shape if it is strong enough to move it */
+	void applyForce(const glm::vec3 &f) {
+		forces += f;
+		if (asleep && glm::length(f) > sleepVelocity * mass) wake();
 	}
 
 	/* Calculate heading vector by rotating "forward" vector to current angle of shape */
@@ -192,6 +322,23 @@ public:
 	float angVelocity;
 	float angAcceleration;
 	float rotForces;
+
+	// adaptive substepping
+	int substeps;            // substeps taken by the current frame
+	int maxSubsteps;
+	float substepClearance;  // fraction of the altitude a substep may travel
+	float substepMinTravel;  // distance per substep allowed right at the ground
+	float substepMaxTravel;  // distance per substep allowed when high
+
+	// rest detection
+	bool asleep;
+	int restFrames;
+	float sleepVelocity;     // speed below which the shape may rest
+	float sleepAngVelocity;  // angular speed (deg/s) below which the shape may rest
+	int sleepFrames;         // frames at rest before the shape sleeps
+
+	VehicleBatch *batch;
+	int batchSlot;
 };
 
 
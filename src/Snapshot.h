@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ofMain.h"
+#include <assert.h>
+#include <type_traits>
+
+// Flat binary snapshot of the simulation state.
+// Objects append their state with put()/putArray() and read it back with
+// get()/getArray() in the same order, so saving and restoring are just a
+// sequence of memcpys into one contiguous buffer.  The buffer keeps its
+// capacity between saves, so repeated checkpoints do not allocate.
+//
+class SimSnapshot {
+public:
+	/* Clear the buffer for a new save (capacity is kept) */
+	void begin() {
+		data.clear();
+		cursor = 0;
+	}
+
+	/* Move the read position back to the start for a restore */
+	void rewind() {
+		cursor = 0;
+	}
+
+	template <typename T> void put(const T &value) {
+		static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+		append(&value, sizeof(T));
+	}
+
+	template <typename T> void get(T &value) {
+		static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+		read(&value, sizeof(T));
+	}
+
+	template <typename T> void putArray(const vector<T> &values) {
+		static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+		uint32_t n = (uint32_t)values.size();
+		put(n);
+		if (n > 0) append(values.data(), n * sizeof(T));
+	}
+
+	template <typename T> void getArray(vector<T> &values) {
+		static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+		uint32_t n = 0;
+		get(n);
+		values.resize(n);
+		if (n > 0) read(values.data(), n * sizeof(T));
+	}
+
+	template <typename T> void putData(const T *values, uint32_t n) {
+		static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+		if (n > 0) append(values, n * sizeof(T));
+	}
+
+	template <typename T> void getData(T *values, uint32_t n) {
+		static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+		if (n > 0) read(values, n * sizeof(T));
+	}
+
+	size_t size() const { return data.size(); }
+	bool empty() const { return data.empty(); }
+
+	vector<char> data;
+	size_t cursor = 0;
+
+private:
+	void append(const void *src, size_t bytes) {
+		size_t offset = data.size();
+		data.resize(offset + bytes);
+		memcpy(&data[offset], src, bytes);
+	}
+
+	void read(void *dst, size_t bytes) {
+		assert(cursor + bytes <= data.size());
+		memcpy(dst, &data[cursor], bytes);
+		cursor += bytes;
+	}
+};
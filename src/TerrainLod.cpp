@@ -0,0 +1,426 @@
+#include "TerrainLod.h"
+#include <unordered_map>
+#include <queue>
+
+// Cut the meshes of "model" into chunksPerSide x chunksPerSide chunks
+// over the ground plane (xz) and simplify each chunk into at most
+// maxLevels levels.  Triangles go to the chunk holding their center, so
+// chunks share the original vertices along their edges.  Each mesh's
+// helper transform is baked into its vertices, so every chunk is drawn
+// with the model matrix alone.
+//
+void TerrainLod::build(ofxAssimpModelLoader &model, int chunksPerSide, int maxLevels) {
+	vector<ofMesh> meshes;
+	vector<ofMaterial> mats;
+	for (int m = 0; m < model.getMeshCount(); m++) {
+		glm::mat4 H = model.getMeshHelperTransform(m);
+		glm::mat4 N = glm::transpose(glm::inverse(H));
+		ofMesh mesh = model.getMesh(m);
+		for (glm::vec3 &v : mesh.getVertices()) v = glm::vec3(H * glm::vec4(v, 1));
+		for (glm::vec3 &n : mesh.getNormals()) n = glm::normalize(glm::vec3(N * glm::vec4(n, 0)));
+		meshes.push_back(mesh);
+		mats.push_back(model.getMaterialForMesh(m));
+	}
+	build(meshes, mats, model.getModelMatrix(), chunksPerSide, maxLevels);
+}
+
+/* Same for bare meshes, drawn with "mats" and the model matrix "m" */
+void TerrainLod::build(const vector<ofMesh> &meshes, const vector<ofMaterial> &mats, const glm::mat4 &m,
+	int chunksPerSide, int maxLevels) {
+	uint64_t start = ofGetElapsedTimeMillis();
+	chunks.clear();
+	materials = mats;
+	materials.resize(meshes.size());
+	sourceTriangles = 0;
+	transform = m;
+
+	// the chunk grid spans every mesh
+	//
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (const ofMesh &mesh : meshes) {
+		for (const glm::vec3 &v : mesh.getVertices()) {
+			lo = glm::min(lo, v);
+			hi = glm::max(hi, v);
+		}
+	}
+	float cellX = std::max((hi.x - lo.x) / chunksPerSide, 1e-6f);
+	float cellZ = std::max((hi.z - lo.z) / chunksPerSide, 1e-6f);
+
+	for (int source = 0; source < (int)meshes.size(); source++) {
+		const ofMesh &mesh = meshes[source];
+		const vector<glm::vec3> &v = mesh.getVertices();
+
+		vector<ofIndexType> idx = mesh.getIndices();
+		if (idx.empty()) {
+			idx.resize(v.size() - v.size() % 3);
+			for (size_t i = 0; i < idx.size(); i++) idx[i] = (ofIndexType)i;
+		}
+		sourceTriangles += (int)idx.size() / 3;
+
+		// vertex normals, averaged from the faces when the model has none
+		//
+		vector<glm::vec3> normals = mesh.getNormals();
+		if (normals.size() != v.size()) {
+			normals.assign(v.size(), glm::vec3(0));
+			for (size_t k = 0; k + 2 < idx.size(); k += 3) {
+				glm::vec3 n = glm::cross(v[idx[k + 1]] - v[idx[k]], v[idx[k + 2]] - v[idx[k]]);
+				normals[idx[k]] += n;
+				normals[idx[k + 1]] += n;
+				normals[idx[k + 2]] += n;
+			}
+			for (glm::vec3 &n : normals) {
+				float len = glm::length(n);
+				n = len > 0 ? n / len : glm::vec3(0, 1, 0);
+			}
+		}
+
+		// bin the triangles by their centers
+		//
+		vector<vector<ofIndexType>> bins(chunksPerSide * chunksPerSide);
+		for (size_t k = 0; k + 2 < idx.size(); k += 3) {
+			glm::vec3 c = (v[idx[k]] + v[idx[k + 1]] + v[idx[k + 2]]) / 3.0f;
+			int ix = ofClamp((int)((c.x - lo.x) / cellX), 0, chunksPerSide - 1);
+			int iz = ofClamp((int)((c.z - lo.z) / cellZ), 0, chunksPerSide - 1);
+			vector<ofIndexType> &bin = bins[iz * chunksPerSide + ix];
+			bin.insert(bin.end(), idx.begin() + k, idx.begin() + k + 3);
+		}
+
+		// every occupied bin becomes a chunk with its own vertex list
+		//
+		for (int cell = 0; cell < (int)bins.size(); cell++) {
+			const vector<ofIndexType> &bin = bins[cell];
+			if (bin.empty()) continue;
+			unordered_map<ofIndexType, ofIndexType> local;
+			vector<glm::vec3> points, pointNormals;
+			vector<ofIndexType> tris;
+			tris.reserve(bin.size());
+			for (ofIndexType i : bin) {
+				auto it = local.find(i);
+				if (it == local.end()) {
+					it = local.emplace(i, (ofIndexType)points.size()).first;
+					points.push_back(v[i]);
+					pointNormals.push_back(normals[i]);
+				}
+				tris.push_back(it->second);
+			}
+			chunks.push_back(TerrainChunk());
+			chunks.back().source = source;
+			chunks.back().cell = cell;
+			buildChunk(chunks.back(), points, pointNormals, tris, maxLevels);
+		}
+	}
+
+	// skirts as deep as the largest error anywhere, enough to cover the
+	// crack between any two levels
+	//
+	float depth = 0;
+	int numLevels = 0;
+	for (const TerrainChunk &c : chunks) {
+		depth = std::max(depth, c.error.back());
+		numLevels = std::max(numLevels, (int)c.levels.size());
+	}
+	if (depth > 0) {
+		for (TerrainChunk &c : chunks) {
+			for (ofVboMesh &level : c.levels) addSkirt(level, depth);
+			c.min.y -= depth;
+		}
+	}
+
+	// culling quadtree over the grid
+	//
+	vector<vector<int>> cellChunks(chunksPerSide * chunksPerSide);
+	for (int i = 0; i < (int)chunks.size(); i++) cellChunks[chunks[i].cell].push_back(i);
+	cullNodes.clear();
+	cullOrder.clear();
+	cullRoot = buildCullNode(cellChunks, chunksPerSide, 0, 0, chunksPerSide, chunksPerSide);
+
+	levelCounts.assign(numLevels, 0);
+	buildMillis = ofGetElapsedTimeMillis() - start;
+}
+
+// Build the quadtree node for the w x h grid squares at (x0, z0), side
+// squares to a row, and return its index (-1 when it holds no chunks).
+// Children are built first, so a node's chunks are the chunks of its
+// children, in one run of cullOrder.
+//
+int TerrainLod::buildCullNode(const vector<vector<int>> &cellChunks, int side, int x0, int z0, int w, int h) {
+	CullNode node;
+	node.first = (int)cullOrder.size();
+	for (int k = 0; k < 4; k++) node.children[k] = -1;
+
+	if (w == 1 && h == 1) {
+		const vector<int> &in = cellChunks[z0 * side + x0];
+		cullOrder.insert(cullOrder.end(), in.begin(), in.end());
+	}
+	else {
+		int w0 = (w + 1) / 2, h0 = (h + 1) / 2;
+		int xs[2] = { x0, x0 + w0 }, ws[2] = { w0, w - w0 };
+		int zs[2] = { z0, z0 + h0 }, hs[2] = { h0, h - h0 };
+		int k = 0;
+		for (int j = 0; j < 2; j++) {
+			for (int i = 0; i < 2; i++) {
+				if (ws[i] == 0 || hs[j] == 0) continue;
+				int child = buildCullNode(cellChunks, side, xs[i], zs[j], ws[i], hs[j]);
+				if (child >= 0) node.children[k++] = child;
+			}
+		}
+	}
+
+	node.count = (int)cullOrder.size() - node.first;
+	if (node.count == 0) return -1;
+	node.min = glm::vec3(FLT_MAX);
+	node.max = glm::vec3(-FLT_MAX);
+	for (int i = node.first; i < node.first + node.count; i++) {
+		node.min = glm::min(node.min, chunks[cullOrder[i]].min);
+		node.max = glm::max(node.max, chunks[cullOrder[i]].max);
+	}
+	cullNodes.push_back(node);
+	return (int)cullNodes.size() - 1;
+}
+
+// Mark the chunks of node n in or out of view.  Nodes fully in or out
+// settle all their chunks at once; only straddling nodes look further.
+//
+void TerrainLod::cullNode(int n, const Frustum &frustum) {
+	const CullNode &node = cullNodes[n];
+	Frustum::Side side = frustum.classify(node.min, node.max);
+	if (side == Frustum::Intersect && node.children[0] >= 0) {
+		for (int k = 0; k < 4 && node.children[k] >= 0; k++) cullNode(node.children[k], frustum);
+		return;
+	}
+
+	bool visible = side != Frustum::Outside;
+	for (int i = node.first; i < node.first + node.count; i++) chunks[cullOrder[i]].visible = visible;
+	if (visible) cull.drawn += node.count;
+	else cull.culled += node.count;
+}
+
+// Build the levels of one chunk from its own vertices and triangles.
+// Level k clusters the vertices into cells 2^k times the average vertex
+// spacing; levels stop when the chunk no longer gets meaningfully
+// smaller.
+//
+void TerrainLod::buildChunk(TerrainChunk &chunk, const vector<glm::vec3> &points,
+	const vector<glm::vec3> &normals, const vector<ofIndexType> &tris, int maxLevels) {
+
+	chunk.min = glm::vec3(FLT_MAX);
+	chunk.max = glm::vec3(-FLT_MAX);
+	for (const glm::vec3 &p : points) {
+		chunk.min = glm::min(chunk.min, p);
+		chunk.max = glm::max(chunk.max, p);
+	}
+
+	ofMesh full;
+	full.addVertices(points);
+	full.addNormals(normals);
+	full.addIndices(tris);
+	chunk.levels.push_back(full);
+	chunk.error.push_back(0);
+	chunk.triangles.push_back((int)tris.size() / 3);
+
+	int n = (int)points.size();
+	glm::vec3 size = chunk.max - chunk.min;
+	float extent = std::max(size.x, std::max(size.y, size.z));
+	if (extent <= 0) return;
+
+	vector<int> remap(n);
+	for (int k = 1; k < maxLevels; k++) {
+		int cells = (int)round(sqrt((float)n) / (1 << k));
+		if (cells < 1) break;
+		float cell = extent / cells;
+
+		// cluster the vertices, summing the members of each cell
+		//
+		unordered_map<uint64_t, int> cluster;
+		vector<glm::vec3> sum, normalSum;
+		vector<int> members;
+		for (int i = 0; i < n; i++) {
+			glm::vec3 g = (points[i] - chunk.min) / cell;
+			uint64_t key = (uint64_t)g.x | ((uint64_t)g.y << 21) | ((uint64_t)g.z << 42);
+			auto it = cluster.emplace(key, (int)sum.size()).first;
+			if (it->second == (int)sum.size()) {
+				sum.push_back(glm::vec3(0));
+				normalSum.push_back(glm::vec3(0));
+				members.push_back(0);
+			}
+			int c = it->second;
+			remap[i] = c;
+			sum[c] += points[i];
+			normalSum[c] += normals[i];
+			members[c]++;
+		}
+
+		ofMesh level;
+		float error = chunk.error.back();
+		for (size_t c = 0; c < sum.size(); c++) {
+			level.addVertex(sum[c] / (float)members[c]);
+			float len = glm::length(normalSum[c]);
+			level.addNormal(len > 0 ? normalSum[c] / len : glm::vec3(0, 1, 0));
+		}
+		// the error is how far the vertices were off the surface of their
+		// cluster; sliding along the surface changes nothing visible
+		//
+		const vector<glm::vec3> &v = level.getVertices();
+		const vector<glm::vec3> &vn = level.getNormals();
+		for (int i = 0; i < n; i++) {
+			int c = remap[i];
+			error = std::max(error, fabs(glm::dot(points[i] - v[c], vn[c])));
+		}
+
+		// triangles whose corners fell into different cells survive
+		//
+		for (size_t t = 0; t + 2 < tris.size(); t += 3) {
+			ofIndexType a = remap[tris[t]], b = remap[tris[t + 1]], c = remap[tris[t + 2]];
+			if (a == b || b == c || a == c) continue;
+			level.addTriangle(a, b, c);
+		}
+
+		int numTris = (int)level.getNumIndices() / 3;
+		if (numTris == 0 || numTris > chunk.triangles.back() * 0.9f) break;
+		chunk.levels.push_back(level);
+		chunk.error.push_back(error);
+		chunk.triangles.push_back(numTris);
+	}
+}
+
+// Hang a vertical strip of "depth" below every open edge of "mesh" (an
+// edge used by only one triangle)
+//
+void TerrainLod::addSkirt(ofMesh &mesh, float depth) {
+	const vector<ofIndexType> &idx = mesh.getIndices();
+	unordered_map<uint64_t, pair<ofIndexType, ofIndexType>> open;
+	for (size_t t = 0; t + 2 < idx.size(); t += 3) {
+		for (int e = 0; e < 3; e++) {
+			ofIndexType a = idx[t + e], b = idx[t + (e + 1) % 3];
+			uint64_t key = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+			auto it = open.find(key);
+			if (it == open.end()) open.emplace(key, make_pair(a, b));
+			else open.erase(it);
+		}
+	}
+
+	glm::vec3 down(0, -depth, 0);
+	for (auto &edge : open) {
+		ofIndexType a = edge.second.first, b = edge.second.second;
+		ofIndexType first = (ofIndexType)mesh.getNumVertices();
+		glm::vec3 pa = mesh.getVertex(a), pb = mesh.getVertex(b);
+		glm::vec3 na = mesh.getNormal(a), nb = mesh.getNormal(b);
+		mesh.addVertex(pa + down);
+		mesh.addNormal(na);
+		mesh.addVertex(pb + down);
+		mesh.addNormal(nb);
+		mesh.addTriangle(b, a, first);
+		mesh.addTriangle(b, first, first + 1);
+	}
+}
+
+// Pick the level of every chunk for the view of "cam".  A level is fine
+// enough when its error, seen from the distance of the chunk's nearest
+// point, covers at most maxPixelError of the viewport's height.  Then
+// coarsen the cheapest chunks while the total is over maxTriangles.
+//
+void TerrainLod::select(const ofCamera &cam, float viewportHeight, const Frustum *frustum) {
+	uint64_t start = ofGetElapsedTimeMicros();
+
+	// cull in model space, with the frustum brought over from the world
+	//
+	cull.reset();
+	if (frustum && cullRoot >= 0) {
+		cullNode(cullRoot, frustum->transformed(transform));
+	}
+	else {
+		for (TerrainChunk &c : chunks) c.visible = true;
+		cull.drawn = (int)chunks.size();
+	}
+
+	// in model space, where the errors were measured; the scale of the
+	// transform cancels out of the projected error
+	//
+	glm::vec3 eye = glm::vec3(glm::inverse(transform) * glm::vec4(cam.getGlobalPosition(), 1));
+	float pixelsPerUnit = viewportHeight / (2 * tan(ofDegToRad(cam.getFov()) / 2));
+
+	vector<float> dist(chunks.size());
+	trianglesDrawn = 0;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		TerrainChunk &c = chunks[i];
+		if (!c.visible) continue;
+		glm::vec3 nearest = glm::clamp(eye, c.min, c.max);
+		dist[i] = std::max(glm::distance(eye, nearest), 1e-3f);
+
+		float allowed = maxPixelError * dist[i] / pixelsPerUnit;
+		int l = 0;
+		while (l + 1 < (int)c.levels.size() && c.error[l + 1] <= allowed) l++;
+		c.level = l;
+		trianglesDrawn += c.triangles[l];
+	}
+
+	// over budget: coarsen the chunks whose next level adds the fewest
+	// pixels of error, one level at a time
+	//
+	if (trianglesDrawn > maxTriangles) {
+		typedef pair<float, int> Step;   // pixels of error, chunk
+		priority_queue<Step, vector<Step>, greater<Step>> next;
+		for (size_t i = 0; i < chunks.size(); i++) {
+			const TerrainChunk &c = chunks[i];
+			if (c.visible && c.level + 1 < (int)c.levels.size())
+				next.push(Step(c.error[c.level + 1] * pixelsPerUnit / dist[i], (int)i));
+		}
+		while (trianglesDrawn > maxTriangles && !next.empty()) {
+			int i = next.top().second;
+			next.pop();
+			TerrainChunk &c = chunks[i];
+			trianglesDrawn -= c.triangles[c.level] - c.triangles[c.level + 1];
+			c.level++;
+			if (c.level + 1 < (int)c.levels.size())
+				next.push(Step(c.error[c.level + 1] * pixelsPerUnit / dist[i], i));
+		}
+	}
+
+	std::fill(levelCounts.begin(), levelCounts.end(), 0);
+	for (const TerrainChunk &c : chunks) {
+		if (c.visible) levelCounts[c.level]++;
+	}
+	selectMicros = ofGetElapsedTimeMicros() - start;
+}
+
+// call f(source, mesh) on the selected level of every chunk in view, in
+// the terrain's model space
+//
+template <typename F> void TerrainLod::drawLevels(F f) {
+	ofPushMatrix();
+	ofMultMatrix(transform);
+	for (TerrainChunk &c : chunks) {
+		if (c.visible) f(c.source, c.levels[c.level]);
+	}
+	ofPopMatrix();
+}
+
+/* Draw the selected levels shaded, with the material of their source mesh */
+void TerrainLod::draw() {
+	int bound = -1;
+	drawLevels([&](int source, ofVboMesh &mesh) {
+		if (source != bound) {
+			if (bound >= 0) materials[bound].end();
+			materials[source].begin();
+			bound = source;
+		}
+		mesh.drawFaces();
+	});
+	if (bound >= 0) materials[bound].end();
+}
+
+/* Draw the selected levels as wireframe */
+void TerrainLod::drawWireframe() {
+	drawLevels([](int, ofVboMesh &mesh) { mesh.drawWireframe(); });
+}
+
+/* Memory held by the vertices and indices of every level */
+size_t TerrainLod::memoryBytes() const {
+	size_t bytes = 0;
+	for (const TerrainChunk &c : chunks) {
+		for (const ofVboMesh &m : c.levels) {
+			bytes += m.getNumVertices() * 2 * sizeof(glm::vec3) + m.getNumIndices() * sizeof(ofIndexType);
+		}
+	}
+	return bytes;
+}
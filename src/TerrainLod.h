@@ -0,0 +1,84 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxAssimpModelLoader.h"
+#include "Frustum.h"
+
+//  One square of the terrain, at every level of detail.  Level 0 is the
+//  original triangles; each next level is the same ground simplified to
+//  about a quarter of the vertices.
+//
+struct TerrainChunk {
+	glm::vec3 min, max;           // bounds in model space, skirts included
+	int source;                   // model mesh the triangles came from
+	int cell;                     // square of the chunk grid it covers
+	vector<ofVboMesh> levels;     // finest first
+	vector<float> error;          // farthest a vertex is off the surface, model units, per level
+	vector<int> triangles;        // per level, skirts not counted
+	int level = 0;                // picked by select() for this frame
+	bool visible = true;          // in the view this frame
+};
+
+//  Level-of-detail terrain.  At load time the model is cut into a grid
+//  of chunks and every chunk is simplified by vertex clustering: the
+//  vertices are binned into cells twice as large at each level and each
+//  cell collapses to the average of its vertices.  Chunks are simplified
+//  independently, so where chunks at different levels meet their edges
+//  no longer match; every level gets a skirt hanging down from its open
+//  edges, deep enough to cover the largest error, to hide those cracks.
+//
+//  Each frame select() picks, per chunk, the coarsest level whose error
+//  projects to at most maxPixelError pixels.  If that is still more than
+//  maxTriangles, the chunks whose next level costs the fewest pixels are
+//  coarsened until it fits, so the triangles drawn stay bounded however
+//  large the terrain is.
+//
+//  With a frustum, select() first culls the chunks through a quadtree of
+//  their bounds; chunks out of view get no level and are not drawn, and
+//  do not count against the triangle budget.
+//
+class TerrainLod {
+public:
+	void build(ofxAssimpModelLoader &model, int chunksPerSide, int maxLevels);
+	void build(const vector<ofMesh> &meshes, const vector<ofMaterial> &mats, const glm::mat4 &m,
+		int chunksPerSide, int maxLevels);
+	void select(const ofCamera &cam, float viewportHeight, const Frustum *frustum = nullptr);
+	void draw();
+	void drawWireframe();
+	size_t memoryBytes() const;
+
+	vector<TerrainChunk> chunks;    // grouped by source mesh
+	vector<ofMaterial> materials;   // per source mesh
+	glm::mat4 transform;            // model matrix the terrain is drawn with
+
+	float maxPixelError = 2;        // screen space error allowed, pixels
+	int maxTriangles = 500000;      // most triangles drawn in a frame
+
+	int sourceTriangles = 0;        // triangles in the full detail model
+	uint64_t buildMillis = 0;
+
+	// last select()
+	int trianglesDrawn = 0;
+	CullStats cull;                 // chunks in and out of view
+	vector<int> levelCounts;        // chunks drawn at each level
+	uint64_t selectMicros = 0;
+
+private:
+	// node of the culling quadtree over the chunk grid; its chunks are a
+	// range of cullOrder
+	struct CullNode {
+		glm::vec3 min, max;
+		int first, count;
+		int children[4];        // -1 for none
+	};
+	vector<CullNode> cullNodes;
+	vector<int> cullOrder;      // chunk indices, each node's contiguous
+	int cullRoot = -1;
+
+	int buildCullNode(const vector<vector<int>> &cellChunks, int side, int x0, int z0, int w, int h);
+	void cullNode(int n, const Frustum &frustum);
+	void buildChunk(TerrainChunk &chunk, const vector<glm::vec3> &points,
+		const vector<glm::vec3> &normals, const vector<ofIndexType> &tris, int maxLevels);
+	static void addSkirt(ofMesh &mesh, float depth);
+	template <typename F> void drawLevels(F f);
+};
@@ -0,0 +1,144 @@
+#include "ThrustPlume.h"
+
+ThrustPlume::ThrustPlume() {
+	setEmitterType(DiskEmitter);
+	setMaxRate(maxRate);
+}
+
+// Set the emission rate at full throttle and size the ring for it: room
+// for every particle born within a lifespan, plus one long frame.  Call
+// after setLifespan().  Particles that live forever (lifespan -1) never
+// expire from the tail, so the ring gets the store's default capacity and
+// its oldest particles are overwritten once it is full.  The ring starts
+// empty.
+//
+void ThrustPlume::setMaxRate(float r) {
+	maxRate = r;
+	int n = lifespan == -1 ? ParticleStore::defaultCapacity :
+		std::max(1, (int)ceil(maxRate * (lifespan + maxFrame)));
+	ParticleStore &ps = sys->particles;
+	ps.setCapacity(n);
+	ps.count = n;
+	clear();
+}
+
+/* Empty the ring */
+void ThrustPlume::clear() {
+	head = 0;
+	live = 0;
+	carry = 0;
+}
+
+/* Slot of the oldest particle */
+int ThrustPlume::tail() const {
+	int t = head - live;
+	return t < 0 ? t + ringSize() : t;
+}
+
+/* Drop up to "n" of the oldest particles, return number dropped */
+int ThrustPlume::cullOldest(int n) {
+	n = std::max(0, std::min(n, live));
+	live -= n;
+	return n;
+}
+
+// particles update(dt) is about to spawn at the current throttle, before
+// spawnScale
+//
+int ThrustPlume::pendingSpawn(float dt) const {
+	return (int)(throttle * maxRate * dt + carry);
+}
+
+// Write "n" newborn particles at the head, overwriting the oldest ones
+// when the ring is full.  The new slots wrap around the end of the store
+// in at most two runs.
+//
+void ThrustPlume::spawnRing(int n) {
+	int size = ringSize();
+	n = std::min(n, size);
+	if (n <= 0) return;
+	if (live + n > size) cullOldest(live + n - size);
+
+	int run = std::min(n, size - head);
+	spawnAt(head, run);
+	if (run < n) spawnAt(0, n - run);
+
+	head = (head + n) % size;
+	live += n;
+	ParticleStore &ps = sys->particles;
+	ps.highWater = std::max(ps.highWater, live);
+}
+
+// Advance the plume by "dt" seconds: expire from the tail, spawn at the
+// head at the throttled rate, then move the live particles, which are at
+// most two contiguous runs of the ring.
+//
+void ThrustPlume::update(float dt) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	ParticleStore &ps = sys->particles;
+	int size = ringSize();
+	clock += dt;
+
+	// expire: the oldest particles are at the tail (-1 lives forever)
+	//
+	expired = 0;
+	int t = tail();
+	while (live > 0 && ps.lifespan[t] != -1 && ps.age[t] > ps.lifespan[t]) {
+		if (++t == size) t = 0;
+		live--;
+		expired++;
+	}
+
+	// spawn, keeping the fraction left over so low rates still emit
+	//
+	float want = throttle * maxRate * spawnScale * dt + carry;
+	spawned = (int)want;
+	carry = want - spawned;
+	spawnRing(spawned);
+
+	// move
+	//
+	sys->collisions = 0;
+	sys->collideMicros = 0;
+	if (live > 0) {
+		t = tail();
+		if (t + live <= size) {
+			sys->step(dt, t, t + live);
+		}
+		else {
+			sys->step(dt, t, size);
+			sys->step(dt, 0, head);
+		}
+		sys->endStep();
+	}
+	updateMicros = ofGetElapsedTimeMicros() - start;
+}
+
+/* Write the live particles as vertices, oldest first */
+void ThrustPlume::packLive(ParticleVertex *out) {
+	int t = tail();
+	int run = std::min(live, ringSize() - t);
+	packVertices(sys->particles, t, t + run, particleRadius, out);
+	packVertices(sys->particles, 0, live - run, particleRadius, out + run);
+}
+
+// append plume and ring state to a snapshot.  The whole ring is saved,
+// so restoring never has to reorder it
+//
+void ThrustPlume::saveState(SimSnapshot &snap) {
+	ParticleEmitter::saveState(snap);
+	snap.put(throttle);
+	snap.put(head);
+	snap.put(live);
+	snap.put(carry);
+}
+
+// read back the state written by saveState
+//
+void ThrustPlume::restoreState(SimSnapshot &snap) {
+	ParticleEmitter::restoreState(snap);
+	snap.get(throttle);
+	snap.get(head);
+	snap.get(live);
+	snap.get(carry);
+}
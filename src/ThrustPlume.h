@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ParticleEmitter.h"
+
+//  Continuous exhaust for a thrusting lander.  Instead of firing a burst
+//  each time the engine lights, the plume emits every frame at a rate
+//  proportional to the throttle, up to maxRate particles per sec.
+//
+//  The particle store is used as a fixed ring of ringSize() slots, all of
+//  them allocated up front: new particles are written at the head and
+//  the oldest sit at the tail.  Every particle gets the same lifespan, so
+//  they expire in the order they were born and expiry just advances the
+//  tail; spawning just advances the head.  Neither moves any particles,
+//  and with the throttle held steady the number of live particles, and
+//  the cost of a frame, stays flat for the whole burn.
+//
+//  The ring is drawn unsorted (additive blending); depth sorting works
+//  on a compact store only.
+//
+class ThrustPlume : public ParticleEmitter {
+public:
+	ThrustPlume();
+	void setMaxRate(float r);
+	void setThrottle(float t) { throttle = ofClamp(t, 0, 1); }
+	int ringSize() const { return sys->particles.size(); }
+	void update(float dt);
+	int pendingSpawn(float dt) const;
+	int liveCount() const { return live; }
+	int cullOldest(int n);
+	void packLive(ParticleVertex *out);
+	void clear();
+	void saveState(SimSnapshot &snap);
+	void restoreState(SimSnapshot &snap);
+
+	float maxRate = 1000;     // particles per sec at full throttle
+	float throttle = 0;       // 0 (off) to 1 (full)
+	float maxFrame = 0.1f;    // sec, longest frame the ring has room for
+
+	int head = 0;             // slot the next particle goes into
+	int live = 0;             // particles in the ring, ending at head
+	float carry = 0;          // fraction of a particle owed to the next frame
+
+	// last frame
+	int spawned = 0;
+	int expired = 0;
+	uint64_t updateMicros = 0;
+
+private:
+	int tail() const;
+	void spawnRing(int n);
+};
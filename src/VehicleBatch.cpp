@@ -0,0 +1,178 @@
+#include "VehicleBatch.h"
+#include "Shape.h"
+
+/* Add a vehicle to the batch and return its slot */
+int VehicleBatch::add(const DynamicShape &shape) {
+	int i = size();
+	px.push_back(0); py.push_back(0); pz.push_back(0);
+	vx.push_back(0); vy.push_back(0); vz.push_back(0);
+	ax.push_back(0); ay.push_back(0); az.push_back(0);
+	fx.push_back(0); fy.push_back(0); fz.push_back(0);
+	rot.push_back(0);
+	angVelocity.push_back(0);
+	angAcceleration.push_back(0);
+	rotForces.push_back(0);
+	invMass.push_back(0);
+	damping.push_back(0);
+	substeps.push_back(1);
+	stepDt.push_back(0);
+	stepDamping.push_back(1);
+	awake.push_back(1);
+	load(i, shape);
+	return i;
+}
+
+/* Copy a shape's physics state into slot i */
+void VehicleBatch::load(int i, const DynamicShape &shape) {
+	px[i] = shape.pos.x;
+	py[i] = shape.pos.y;
+	pz[i] = shape.pos.z;
+	vx[i] = shape.velocity.x;
+	vy[i] = shape.velocity.y;
+	vz[i] = shape.velocity.z;
+	ax[i] = shape.acceleration.x;
+	ay[i] = shape.acceleration.y;
+	az[i] = shape.acceleration.z;
+	fx[i] = shape.forces.x;
+	fy[i] = shape.forces.y;
+	fz[i] = shape.forces.z;
+	rot[i] = shape.rot;
+	angVelocity[i] = shape.angVelocity;
+	angAcceleration[i] = shape.angAcceleration;
+	rotForces[i] = shape.rotForces;
+	invMass[i] = 1.0f / shape.mass;
+	damping[i] = shape.damping;
+	substeps[i] = shape.substeps;
+	setAsleep(i, shape.asleep);
+}
+
+/* Copy slot i back into a shape */
+void VehicleBatch::store(int i, DynamicShape &shape) const {
+	shape.pos = glm::vec3(px[i], py[i], pz[i]);
+	shape.velocity.set(vx[i], vy[i], vz[i]);
+	shape.forces.set(fx[i], fy[i], fz[i]);
+	shape.rot = rot[i];
+	shape.angVelocity = angVelocity[i];
+	shape.rotForces = rotForces[i];
+}
+
+/* Accumulate a force on vehicle i for the next step */
+void VehicleBatch::addForce(int i, const glm::vec3 &f) {
+	fx[i] += f.x;
+	fy[i] += f.y;
+	fz[i] += f.z;
+}
+
+/* Put vehicle i to sleep (skipped by integrate) or wake it up */
+void VehicleBatch::setAsleep(int i, bool state) {
+	float a = state ? 0.0f : 1.0f;
+	if (awake[i] == a) return;
+	awake[i] = a;
+	numAsleep += state ? 1 : -1;
+}
+
+/* Remove every vehicle */
+void VehicleBatch::clear() {
+	px.clear(); py.clear(); pz.clear();
+	vx.clear(); vy.clear(); vz.clear();
+	ax.clear(); ay.clear(); az.clear();
+	fx.clear(); fy.clear(); fz.clear();
+	rot.clear();
+	angVelocity.clear();
+	angAcceleration.clear();
+	rotForces.clear();
+	invMass.clear();
+	damping.clear();
+	substeps.clear();
+	stepDt.clear();
+	stepDamping.clear();
+	awake.clear();
+	numAsleep = 0;
+}
+
+/* Integrate every vehicle with the same Euler step as DynamicShape::integrate,
+   each vehicle split into its own number of substeps */
+void VehicleBatch::integrate(float dt) {
+	int n = size();
+	if (n == numAsleep) {          // nothing awake, only drop the forces
+		clearForces();
+		return;
+	}
+
+	// raw pointers keep the loops free of aliasing through vector so the
+	// compiler can vectorize each of them
+	//
+	float *x = px.data(), *y = py.data(), *z = pz.data();
+	float *u = vx.data(), *v = vy.data(), *w = vz.data();
+	const float *ux = ax.data(), *uy = ay.data(), *uz = az.data();
+	float *f0 = fx.data(), *f1 = fy.data(), *f2 = fz.data();
+	float *r = rot.data(), *av = angVelocity.data(), *rf = rotForces.data();
+	const float *aa = angAcceleration.data();
+	const float *im = invMass.data();
+	const int *sub = substeps.data();
+	float *h = stepDt.data(), *d = stepDamping.data();
+
+	// per-vehicle substep interval and damping.  Sleeping slots get a zero
+	// step and no damping, which leaves them untouched without a branch in
+	// the loops below
+	//
+	stepSubsteps = 1;
+	for (int i = 0; i < n; i++) {
+		if (awake[i] == 0) {
+			h[i] = 0;
+			d[i] = 1;
+			continue;
+		}
+		h[i] = dt / sub[i];
+		d[i] = pow(damping[i], 1.0f / sub[i]);
+		stepSubsteps = std::max(stepSubsteps, sub[i]);
+	}
+
+	// gravity is added to the accumulated forces, as in DynamicShape
+	for (int i = 0; i < n; i++) {
+		f1[i] += gravity;
+	}
+
+	for (int s = 0; s < stepSubsteps; s++) {
+
+		/* Linear integration */
+		for (int i = 0; i < n; i++) {
+			// vehicles that have taken all their substeps sit this one out
+			float on = s < sub[i] ? 1.0f : 0.0f;
+			float hi = h[i] * on;
+			float di = 1.0f + (d[i] - 1.0f) * on;
+
+			// update position based on velocity
+			x[i] += u[i] * hi;
+			y[i] += v[i] * hi;
+			z[i] += w[i] * hi;
+
+			// update velocity with acceleration and accumulated forces, then damp
+			u[i] = (u[i] + (ux[i] + f0[i] * im[i]) * hi) * di;
+			v[i] = (v[i] + (uy[i] + f1[i] * im[i]) * hi) * di;
+			w[i] = (w[i] + (uz[i] + f2[i] * im[i]) * hi) * di;
+		}
+
+		/* Angular integration */
+		for (int i = 0; i < n; i++) {
+			float on = s < sub[i] ? 1.0f : 0.0f;
+			float hi = h[i] * on;
+			float di = 1.0f + (d[i] - 1.0f) * on;
+			r[i] += av[i] * hi;
+			av[i] = (av[i] + (aa[i] + rf[i] * im[i]) * hi) * di;
+		}
+	}
+
+	clearForces();
+}
+
+// clear forces (they get re-added each frame).  Sleeping vehicles are
+// cleared too, or pushes while asleep would all land at once on waking
+//
+void VehicleBatch::clearForces() {
+	int n = size();
+	std::fill(fx.begin(), fx.begin() + n, 0.0f);
+	std::fill(fy.begin(), fy.begin() + n, 0.0f);
+	std::fill(fz.begin(), fz.begin() + n, 0.0f);
+	std::fill(rotForces.begin(), rotForces.begin() + n, 0.0f);
+}
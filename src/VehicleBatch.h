@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ofMain.h"
+
+class DynamicShape;
+
+// Struct-of-arrays store for the physics state of many vehicles.
+// Every vehicle owns one slot in the parallel arrays below, so the whole
+// fleet (player, AI landers, replay ghosts) is integrated in one tight,
+// vectorizable pass instead of one DynamicShape at a time.
+//
+class VehicleBatch {
+public:
+	int add(const DynamicShape &shape);
+	void load(int i, const DynamicShape &shape);
+	void store(int i, DynamicShape &shape) const;
+	void addForce(int i, const glm::vec3 &f);
+	void setAsleep(int i, bool state);
+	void integrate(float dt);
+	void clear();
+	int size() const { return (int)px.size(); }
+
+	// linear state
+	vector<float> px, py, pz;
+	vector<float> vx, vy, vz;
+	vector<float> ax, ay, az;
+	vector<float> fx, fy, fz;
+
+	// angular state (rotation about the y axis, degrees)
+	vector<float> rot;
+	vector<float> angVelocity;
+	vector<float> angAcceleration;
+	vector<float> rotForces;
+
+	// constants
+	vector<float> invMass;
+	vector<float> damping;
+
+	// substeps each vehicle takes this frame, with the per-substep
+	// interval and damping derived from it in integrate()
+	vector<int> substeps;
+	vector<float> stepDt;
+	vector<float> stepDamping;
+	int stepSubsteps = 1;       // largest substep count of the last integrate()
+
+	// rest state: 1 for awake slots, 0 for sleeping ones
+	vector<float> awake;
+	int numAsleep = 0;
+
+	float gravity = -1.62f;
+
+private:
+	void clearForces();
+};
@@ -0,0 +1,112 @@
+#include "WorkerPool.h"
+
+/* Create a pool using "numThreads" threads in total (0 = one per core) */
+WorkerPool::WorkerPool(int numThreads) {
+	nextChunk = 0;
+	chunksDone = 0;
+	setNumThreads(numThreads);
+}
+
+WorkerPool::~WorkerPool() {
+	stop();
+}
+
+/* The pool shared by all particle systems */
+WorkerPool &WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
+
+/* Restart the pool with "numThreads" threads in total, including the caller (0 = one per core) */
+void WorkerPool::setNumThreads(int numThreads) {
+	if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+	stop();
+	start(numThreads - 1);
+}
+
+void WorkerPool::start(int numWorkers) {
+	quit = false;
+	for (int i = 0; i < numWorkers; i++) {
+		threads.emplace_back(&WorkerPool::workerLoop, this);
+	}
+}
+
+void WorkerPool::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_all();
+	for (int i = 0; i < (int)threads.size(); i++) {
+		threads[i].join();
+	}
+	threads.clear();
+}
+
+// run chunks of the current job until none are left
+//
+void WorkerPool::runChunks() {
+	int c;
+	while ((c = nextChunk.fetch_add(1)) < numChunks) {
+		int begin = c * jobGrain;
+		int end = std::min(begin + jobGrain, jobSize);
+		(*job)(begin, end, c);
+		chunksDone.fetch_add(1);
+	}
+}
+
+// workers sleep until a new job generation is posted, help with it, then
+// check back in so the caller knows nobody is still touching the job
+//
+void WorkerPool::workerLoop() {
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [&]() { return quit || generation != seen; });
+			if (quit) return;
+			seen = generation;
+		}
+		runChunks();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			busyWorkers--;
+		}
+		done.notify_one();
+	}
+}
+
+/* Run job(begin, end, chunk) over [0, n) in chunks of "grain" items */
+void WorkerPool::parallelFor(int n, int grain, const function<void(int, int, int)> &job) {
+	if (n <= 0) return;
+	grain = std::max(grain, 1);
+	int chunks = (n + grain - 1) / grain;
+
+	// not worth waking the workers
+	if (chunks == 1 || threads.empty()) {
+		for (int c = 0; c < chunks; c++) {
+			job(c * grain, std::min(c * grain + grain, n), c);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		this->job = &job;
+		jobSize = n;
+		jobGrain = grain;
+		numChunks = chunks;
+		nextChunk = 0;
+		chunksDone = 0;
+		busyWorkers = (int)threads.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	// the calling thread works too
+	runChunks();
+
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [&]() { return busyWorkers == 0 && chunksDone == numChunks; });
+	this->job = nullptr;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ofMain.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+//  Persistent pool of worker threads shared by the simulation.
+//  parallelFor() splits [0, n) into fixed-size chunks and runs them on the
+//  workers and the calling thread, returning when every chunk is done.
+//  Chunk boundaries depend only on n and the grain size, never on the
+//  number of threads, so per-chunk work (and per-chunk random seeds) is
+//  the same whatever the thread count.
+//
+class WorkerPool {
+public:
+	WorkerPool(int numThreads = 0);
+	~WorkerPool();
+	void setNumThreads(int numThreads);
+	int getNumThreads() const { return (int)threads.size() + 1; }
+	void parallelFor(int n, int grain, const function<void(int begin, int end, int chunk)> &job);
+
+	static WorkerPool &shared();
+
+private:
+	void start(int numWorkers);
+	void stop();
+	void workerLoop();
+	void runChunks();
+
+	vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	// current job
+	const function<void(int, int, int)> *job = nullptr;
+	int jobSize = 0;
+	int jobGrain = 1;
+	int numChunks = 0;
+	std::atomic<int> nextChunk;
+	std::atomic<int> chunksDone;
+	int busyWorkers = 0;
+	uint64_t generation = 0;
+	bool quit = false;
+};
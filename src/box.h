@@ -47,7 +47,7 @@ class Box {
 
 	// implement for Homework Project
 	//
-	 bool overlap(const Box &box) {
+	 bool overlap(const Box &box) const {
 		 // check if min corner of this box is before the max of the specifed box && 
 		 //          max corner of this box is after the min of the specifed box for x,y,z coordinates
 		 return ((parameters[0].x() <= box.parameters[1].x() && parameters[1].x() >= box.parameters[0].x()) &&
@@ -1,8 +1,14 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "ParticleBench.h"
 
 //========================================================================
-int main( ){
+int main(int argc, char *argv[]){
+	// headless particle benchmarks: --bench [results.json|results.csv]
+	if (argc > 1 && string(argv[1]) == "--bench") {
+		return runParticleSuiteMain(argc > 2 ? argv[2] : "");
+	}
+
 	ofSetupOpenGL(1280, 1024,OF_WINDOW);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
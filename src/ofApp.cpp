@@ -11,6 +11,7 @@
 
 #include "ofApp.h"
 #include "Util.h"
+#include "ParticleBench.h"
 
 
 //--------------------------------------------------------------
@@ -63,6 +64,16 @@ void ofApp::setup(){
 	float scaleFactor = 0.25;
 	player.scale = glm::vec3(scaleFactor, scaleFactor, scaleFactor);
 	player.lander.setScaleNormalization(false);
+	player.attachBatch(&vehicles);
+
+	// crash explosions outrank thrust when the particle budget is tight
+	particleBudget.add(&player.emitter, 2);
+	particleBudget.add(&player.thrust, 1);
+
+	// the lander broken into a few hundred pieces, room for several crashes
+	debris.shatter(player.lander, scaleFactor, 200);
+	debris.setCapacity(1200);
+	debris.setSeed(3);
 	//player.lander.setRotation(0, -90, 0, 1, 0); // Rotate 90 degrees counterclockwise around Y-axis
 	bLanderLoaded = true;
 
@@ -77,6 +88,7 @@ void ofApp::setup(){
 	gui.setup();
 	gui.add(numLevels.setup("Number of Octree Levels", 1, 1, 10));
 	gui.add(timingToggle.setup("Timing Info", true));
+	gui.add(debrisToggle.setup("Debris Explosion", false));
 	
 	bHide = true;
 
@@ -93,10 +105,20 @@ void ofApp::setup(){
 	}
 	uint64_t endBuildTime = ofGetSystemTimeMillis();
 
+	// explosion debris and thrust exhaust land on the terrain
+	player.emitter.sys->setTerrain(&octree);
+	player.thrust.sys->setTerrain(&octree);
+	debris.terrain = &octree;
+
+	// the terrain is drawn through chunks with levels of detail
+	terrain.build(mars, 16, 6);
+
 	// calculate build time
 	bTimingInfo = timingToggle;
 	if (bTimingInfo) {
 		cout << "Build Time: " << endBuildTime - startBuildTime << endl;
+		cout << "Terrain LOD: " << terrain.chunks.size() << " chunks, " << terrain.levelCounts.size()
+			<< " levels, built in " << terrain.buildMillis << " ms" << endl;
 	}
 	
 	cout << "Number of Verts: " << mars.getMesh(0).getNumVertices() << endl;
@@ -138,6 +160,7 @@ void ofApp::update() {
 
 	/* Player */
 	bool isMoving = false; // Track if player is moving to control sound
+	float throttle = 0;    // thrust input, sets the exhaust rate
 
 	if (bLanderLoaded) {
 		// rotate player counterclockwise
@@ -145,12 +168,14 @@ void ofApp::update() {
 			//cout << "a key" << endl;
 			player.rotateCounterclockwise();
 			isMoving = true;
+			throttle += 0.25f;
 		}
 		// rotate player clockwise
 		if (keymap['d']) {
 			//cout << "d key" << endl;
 			player.rotateClockwise();
 			isMoving = true;
+			throttle += 0.25f;
 		}
 		// move player upward
 		if (keymap['w']) {
@@ -158,6 +183,7 @@ void ofApp::update() {
 			if (player.fuel > 0) {
 				player.moveUp();
 				isMoving = true;
+				throttle += 0.5f;
 			}
 		}
 		// move player downward
@@ -166,6 +192,7 @@ void ofApp::update() {
 			if (player.fuel > 0) {
 				player.moveDown();
 				isMoving = true;
+				throttle += 0.5f;
 			}
 		}
 		// move forward along the heading vector
@@ -175,6 +202,7 @@ void ofApp::update() {
 			if (player.fuel > 0) {
 				player.moveForward();
 				isMoving = true;
+				throttle += 0.5f;
 			}
 		}
 		// move backward along the heading vector
@@ -184,6 +212,7 @@ void ofApp::update() {
 			if (player.fuel > 0) {
 				player.moveBackward();
 				isMoving = true;
+				throttle += 0.5f;
 			}
 		}
 		// move right of the heading vector 
@@ -191,6 +220,7 @@ void ofApp::update() {
 			if (player.fuel > 0) {
 				player.moveRight();
 				isMoving = true;
+				throttle += 0.5f;
 			}
 		}
 		// move left of the heading vector
@@ -198,14 +228,20 @@ void ofApp::update() {
 			if (player.fuel > 0) {
 				player.moveLeft();
 				isMoving = true;
+				throttle += 0.5f;
 			}
 		}
 
+		// any input wakes a resting player
+		if (isMoving) player.wake();
+
+		// exhaust flows at a rate set by the thrusters in use, full
+		// throttle from two of them
+		player.thrust.setThrottle(throttle);
+
 		// Sound handling for thrust
 		if (isMoving) {
 			if (!bThrustPlaying) {
-				player.diskEmitter.sys->reset();
-				player.diskEmitter.start();
 				player.fuel -= player.fuelConsumptionRate; // Consume fuel
 				if (player.fuel < 0) player.fuel = 0;
 				thrustSound.play();
@@ -234,86 +270,96 @@ void ofApp::update() {
 		}
 	}
 
-	// lander bounds
-	ofVec3f min = player.lander.getSceneMin() + player.getPosition();
-	ofVec3f max = player.lander.getSceneMax() + player.getPosition();
-	Box bounds = Box(Vector3(min.x, min.y, min.z), Vector3(max.x, max.y, max.z));
+	/* Collision */
+	// a sleeping player keeps its last contacts and skips collision entirely
+	bool bPlayerAsleep = player.isAsleep();
 
-	// update collision box list
-	colBoxList.clear();
-	octree.intersect(bounds, octree.root, colBoxList);
+	// detection fills the contact queue, the passes after it consume it
+	uint64_t startDetect = ofGetElapsedTimeMicros();
+	contacts.clear();
+	if (!bPlayerAsleep) detectCollisions();
 
-	if(colBoxList.size() >= 5) {
-		cout << "Collision detected" << endl;
-		bReverse = true;
+	uint64_t startResolve = ofGetElapsedTimeMicros();
+	resolveContacts();
+
+	uint64_t startEffects = ofGetElapsedTimeMicros();
+	applyContactEffects();
+
+	uint64_t startHud = ofGetElapsedTimeMicros();
+	updateContactHud();
+
+	uint64_t endHud = ofGetElapsedTimeMicros();
+	detectMicros = startResolve - startDetect;
+	resolveMicros = startEffects - startResolve;
+	effectsMicros = startHud - startEffects;
+	hudMicros = endHud - startHud;
+
+	/* Altitude */
+	// one ray cast per frame, shared by substepping and the HUD.
+	// a sleeping player has not moved, so the last reading still holds
+	if (!bPlayerAsleep) {
+		altitude = getAltitude();
 	}
 
-	/* Collision */
-	// if model is in collided state
-	if (bReverse) {
-		// get lander's current position and velocity
-		glm::vec3 currPos = player.lander.getPosition();
-		glm::vec3 landerVelocity = currPos - landerLastPos;
-
-		// interval for this step
-		float dt = 1.0 / ofGetFrameRate();
-
-		// get normal for the vertex in the mesh where lander is in contact with
-		glm::vec3 collisionNormalSum = glm::vec3(0, 0, 0);
-		float numPoints = 0;
-		// for each contact point, get the normal
-		for (Box box : colBoxList) {
-			// points in colided mesh's bounding boxes
-			vector<int> pointsRtn;
-			octree.getMeshPointsInBox(octree.mesh, octree.root.points, box, pointsRtn);
-			for (int i = 0; i < pointsRtn.size(); i++) {
-				collisionNormalSum += octree.mesh.getNormal(pointsRtn[i]);
-			}
-			numPoints += pointsRtn.size();
-		}
-		// calculate the averge normal from all the contact points
-		glm::vec3 avgCollisionNormal;
-		if (numPoints > 0) {
-			avgCollisionNormal = glm::normalize(collisionNormalSum / numPoints);
-		}
-		else {
-			avgCollisionNormal = glm::vec3(0, 1, 0);  // Default to upward if no points
-		}
+	/* Physics */
+	uint64_t startPhysics = ofGetElapsedTimeMicros();
 
-		// Calculate impulse force
-		float impulseScale = 0.5f;
-		glm::vec3 impulseForce = glm::reflect(landerVelocity, avgCollisionNormal) * impulseScale;
-		//cout << "impulse force length" << glm::length(impulseForce) << endl;
-		if (player.isVisible() && glm::length(impulseForce) > 60.f) {
-			player.breakPlayer();
-			sprintf(scoreStr, "Game Over");
-			bShowScore = true;
-			player.emitter.forces += impulseForce;
-		}
-		else {
-			player.forces += impulseForce;
-			if (player.isVisible()) {
-				sprintf(scoreStr, "Landed Safely");
-				bShowScore = true;
-			}
-			if (colBoxList.size() < 1) {
-				bReverse = false;
-			}
-		}
+	// simulation time for this frame, none while the frame rate is unknown
+	float dt = 0;
+	if (ofGetFrameRate() != 0) dt = 1.0 / ofGetFrameRate();
+
+	// subdivide the step when fast or close to the terrain
+	if (dt > 0) {
+		player.updateSubsteps(altitude, dt);
 	}
+	integrateVehicles();
+	particleBudget.beginFrame(dt);
+	player.update(dt);
+	particleBudget.endFrame();
+	debris.update(dt);
+
+	physicsMicros = ofGetElapsedTimeMicros() - startPhysics;
 
-	player.update();
+	/* Rest */
+	// put the player to sleep once it has settled on the terrain
+	if (!bPlayerAsleep) player.updateRest(colBoxList.size() > 0);
 
 	/* Altitude */
 	if (bShowAltitude) {
-		float agl = getAltitude();
-		if (agl == -1) {
+		if (altitude == -1) {
 			sprintf(altitudeStr, "Altitude AGL: -------");
 		}
 		else {
-			sprintf(altitudeStr, "Altitude AGL: %f", getAltitude());
+			sprintf(altitudeStr, "Altitude AGL: %f", altitude);
 		}
 	}
+
+	/* Timing */
+	if (bTimingInfo) {
+		snprintf(timingStr, sizeof timingStr, "FPS: %.1f\nSubsteps: %d\nPhysics: %llu us\nContacts: %llu / %llu / %llu / %llu us\nSnapshot: %llu / %llu us\nTerrain LOD: %d / %d tris, %llu us\nDrawn / culled: %d / %d chunks, %d / %d octree, %d / %d boxes",
+			ofGetFrameRate(), player.isAsleep() ? 0 : player.substeps,
+			(unsigned long long)physicsMicros,
+			(unsigned long long)detectMicros, (unsigned long long)resolveMicros,
+			(unsigned long long)effectsMicros, (unsigned long long)hudMicros,
+			(unsigned long long)snapshotSaveMicros, (unsigned long long)snapshotRestoreMicros,
+			terrain.trianglesDrawn, terrain.sourceTriangles, (unsigned long long)terrain.selectMicros,
+			terrain.cull.drawn, terrain.cull.culled, octreeCull.drawn, octreeCull.culled,
+			boxCull.drawn, boxCull.culled);
+
+		// live particles / pool capacity (high-water mark) per emitter
+		const ParticleStore &explosion = player.emitter.sys->particles;
+		const ThrustPlume &thrust = player.thrust;
+		snprintf(particleStr, sizeof particleStr, "Explosion: %d / %d (peak %d), sort %llu us\nThrust: %d / %d (peak %d), %d/s, %llu us\nBudget: %d / %d, %llu us, culled %d\nTerrain: %d hits, %llu us\nDebris: %d awake / %d, %d contacts, %llu us",
+			explosion.size(), explosion.capacity(), explosion.highWater,
+			(unsigned long long)player.emitter.sorter.sortMicros,
+			thrust.liveCount(), thrust.ringSize(), thrust.sys->particles.highWater,
+			(int)(thrust.throttle * thrust.maxRate), (unsigned long long)thrust.updateMicros,
+			particleBudget.total(), particleBudget.limit,
+			(unsigned long long)particleBudget.frameMicros, particleBudget.culled,
+			player.emitter.sys->collisions + player.thrust.sys->collisions,
+			(unsigned long long)(player.emitter.sys->collideMicros + player.thrust.sys->collideMicros),
+			debris.awakeCount(), debris.size(), debris.contacts, (unsigned long long)debris.updateMicros);
+	}
 }
 //--------------------------------------------------------------
 void ofApp::draw() {
@@ -324,12 +370,20 @@ void ofApp::draw() {
 	ofEnableDepthTest();
 	ofEnableLighting();
 
+	// cull against the active camera's view, then pick the terrain's
+	// levels of detail for the chunks left
+	ofCamera &viewCam = cameraSystem.getCamera();
+	frustum.set(viewCam.getModelViewProjectionMatrix());
+	octreeCull.reset();
+	boxCull.reset();
+	terrain.select(viewCam, ofGetViewportHeight(), &frustum);
+
 	cameraSystem.begin();
 	ofPushMatrix();
 	if (bWireframe) {                    // wireframe mode  (include axis)
 		ofDisableLighting();
 		ofSetColor(ofColor::slateGray);
-		mars.drawWireframe();
+		terrain.drawWireframe();
 		if (bLanderLoaded) {
 			player.drawWireframe();
 			if (!bTerrainSelected) drawAxis(player.getPosition());
@@ -338,10 +392,12 @@ void ofApp::draw() {
 	}
 	else {
 		ofEnableLighting();              // shaded mode
-		mars.drawFaces();
+		terrain.draw();
 		ofMesh mesh;
 		if (bLanderLoaded) {
 			player.draw();
+			ofSetColor(ofColor::lightGray);
+			debris.draw();
 			if (!bTerrainSelected) drawAxis(player.getPosition());
 			if (bDisplayBBoxes) {
 				ofNoFill();
@@ -368,7 +424,12 @@ void ofApp::draw() {
 				//
 				ofSetColor(ofColor::lightBlue);
 				for (int i = 0; i < colBoxList.size(); i++) {
+					if (!frustum.visible(colBoxList[i])) {
+						boxCull.culled++;
+						continue;
+					}
 					Octree::drawBox(colBoxList[i]);
+					boxCull.drawn++;
 				}
 			}
 		}
@@ -388,7 +449,7 @@ void ofApp::draw() {
 	else if (bDisplayOctree) {
 		ofNoFill();
 		ofSetColor(ofColor::white);
-		octree.draw(numLevels, 0, colors);
+		octree.draw(octree.root, numLevels, 0, colors, frustum, octreeCull);
 	}
 
 	ofPopMatrix();
@@ -406,6 +467,13 @@ void ofApp::draw() {
 		font.drawString(scoreStr, 30, 50);
 	}
 
+	/* Timing */
+	if (bTimingInfo) {
+		ofSetColor(ofColor::white);
+		font.drawString(timingStr, 30, ofGetHeight() - 200);
+		font.drawString(particleStr, ofGetWidth() - 420, ofGetHeight() - 130);
+	}
+
 
 	if (bLanderLoaded) {
 		// Draw background (gray)
@@ -508,6 +576,14 @@ void ofApp::keyPressed(int key) {
 	case 'H':
 	case 'h':
 		break;
+	case 'j':
+		// jump back to the saved checkpoint
+		if (!checkpoint.empty()) restoreSnapshot(checkpoint);
+		break;
+	case 'k':
+		// save a checkpoint of the current simulation state
+		saveSnapshot(checkpoint);
+		break;
 	case 'L':
 	case 'l':
 		bDisplayLeafNodes = !bDisplayLeafNodes;
@@ -535,6 +611,10 @@ void ofApp::keyPressed(int key) {
 	case 'w':
 		//toggleWireframeMode();
 		break;
+	case 'z':
+		// print particle performance numbers to the console
+		runParticleBenchmarks();
+		break;
 	case OF_KEY_ALT:
 		cameraSystem.enableMouseInput();
 		bAltKeyDown = true;
@@ -778,6 +858,163 @@ void ofApp::savePicture() {
 }
 
 
+/* Collision detection: finds the terrain boxes overlapping the player and,
+   while in the collided state, queues a contact event with the average
+   terrain normal.  No response happens here */
+void ofApp::detectCollisions() {
+	// lander bounds
+	ofVec3f min = player.lander.getSceneMin() + player.getPosition();
+	ofVec3f max = player.lander.getSceneMax() + player.getPosition();
+	Box bounds = Box(Vector3(min.x, min.y, min.z), Vector3(max.x, max.y, max.z));
+
+	// update collision box list
+	colBoxList.clear();
+	octree.intersect(bounds, octree.root, colBoxList);
+
+	if (colBoxList.size() >= 5) {
+		cout << "Collision detected" << endl;
+		bReverse = true;
+	}
+
+	// only a model in collided state produces a contact
+	if (!bReverse) return;
+
+	// get lander's current position and velocity
+	glm::vec3 currPos = player.lander.getPosition();
+	glm::vec3 landerVelocity = currPos - landerLastPos;
+
+	// get normal for the vertex in the mesh where lander is in contact with
+	glm::vec3 collisionNormalSum = glm::vec3(0, 0, 0);
+	float numPoints = 0;
+	// for each contact point, get the normal
+	for (Box box : colBoxList) {
+		// points in colided mesh's bounding boxes
+		vector<int> pointsRtn;
+		octree.getMeshPointsInBox(octree.mesh, octree.root.points, box, pointsRtn);
+		for (int i = 0; i < (int)pointsRtn.size(); i++) {
+			collisionNormalSum += octree.mesh.getNormal(pointsRtn[i]);
+		}
+		numPoints += pointsRtn.size();
+	}
+
+	ContactEvent contact;
+	contact.body = player.batchSlot;
+	contact.numBoxes = (int)colBoxList.size();
+	contact.velocity = landerVelocity;
+	contact.impulse = glm::vec3(0, 0, 0);
+	contact.crash = false;
+
+	// calculate the averge normal from all the contact points
+	if (numPoints > 0) {
+		contact.normal = glm::normalize(collisionNormalSum / numPoints);
+	}
+	else {
+		contact.normal = glm::vec3(0, 1, 0);  // Default to upward if no points
+	}
+	contacts.push_back(contact);
+}
+
+/* Collision response: computes the impulse for each queued contact,
+   decides whether it is a crash and applies the force */
+void ofApp::resolveContacts() {
+	for (ContactEvent &contact : contacts) {
+		// Calculate impulse force
+		float impulseScale = 0.5f;
+		contact.impulse = glm::reflect(contact.velocity, contact.normal) * impulseScale;
+		//cout << "impulse force length" << glm::length(contact.impulse) << endl;
+		contact.crash = player.isVisible() && glm::length(contact.impulse) > 60.f;
+
+		if (contact.crash) {
+			player.emitter.forces += contact.impulse;
+		}
+		else {
+			player.applyForce(contact.impulse);
+			if (contact.numBoxes < 1) {
+				bReverse = false;
+			}
+		}
+	}
+}
+
+/* Collision effects and audio: explodes the player on a crash */
+void ofApp::applyContactEffects() {
+	for (const ContactEvent &contact : contacts) {
+		if (contact.crash) {
+			player.breakPlayer(debrisToggle ? &debris : NULL);
+
+			// a broken lander has no thrust to hear
+			if (bThrustPlaying) {
+				thrustSound.stop();
+				bThrustPlaying = false;
+			}
+		}
+	}
+}
+
+/* Collision HUD: reports the outcome of the queued contacts */
+void ofApp::updateContactHud() {
+	for (const ContactEvent &contact : contacts) {
+		if (contact.crash) {
+			sprintf(scoreStr, "Game Over");
+			bShowScore = true;
+		}
+		else if (player.isVisible()) {
+			sprintf(scoreStr, "Landed Safely");
+			bShowScore = true;
+		}
+	}
+}
+
+/* Captures the complete simulation state into a flat binary snapshot */
+void ofApp::saveSnapshot(SimSnapshot &snap) {
+	uint64_t start = ofGetElapsedTimeMicros();
+
+	snap.begin();
+	player.saveState(snap);
+	debris.saveState(snap);
+	snap.put(bReverse);
+	snap.put(landerLastPos);
+	snap.put(bShowScore);
+	snap.put(scoreStr);
+	snap.put(bThrustPlaying);
+
+	snapshotSaveMicros = ofGetElapsedTimeMicros() - start;
+	cout << "Snapshot saved: " << snap.size() << " bytes in " << snapshotSaveMicros << " us" << endl;
+}
+
+/* Restores the simulation state captured by saveSnapshot */
+void ofApp::restoreSnapshot(SimSnapshot &snap) {
+	uint64_t start = ofGetElapsedTimeMicros();
+
+	snap.rewind();
+	player.restoreState(snap);
+	debris.restoreState(snap);
+	snap.get(bReverse);
+	snap.get(landerLastPos);
+	snap.get(bShowScore);
+	snap.get(scoreStr);
+	snap.get(bThrustPlaying);
+
+	snapshotRestoreMicros = ofGetElapsedTimeMicros() - start;
+	cout << "Snapshot restored: " << snap.size() << " bytes in " << snapshotRestoreMicros << " us" << endl;
+
+	// thrust sound follows the restored state
+	if (bThrustPlaying) thrustSound.play();
+	else thrustSound.stop();
+}
+
+/* Integrates every vehicle in the scene in one batched pass */
+void ofApp::integrateVehicles() {
+	if (ofGetFrameRate() == 0) return;
+
+	// interval for this step
+	float dt = 1.0 / ofGetFrameRate();
+
+	player.pushState();
+	vehicles.integrate(dt);
+	player.pullState();
+}
+
 /* Returns player's altitude above ground level */
 float ofApp::getAltitude() {
 	// return negative if player has exploded
@@ -6,6 +6,10 @@
 #include "Octree.h"
 #include "Player.h"
 #include "CameraSystem.h"
+#include "ContactEvent.h"
+#include "ParticleBudget.h"
+#include "DebrisBatch.h"
+#include "TerrainLod.h"
 #include <glm/gtx/intersect.hpp>
 
 
@@ -56,6 +60,9 @@ class ofApp : public ofBaseApp{
 		vector<Box> colBoxList;
 		bool bLanderSelected = false;
 		Octree octree;
+		TerrainLod terrain;   // chunked, level of detail copy of mars for drawing
+		Frustum frustum;      // view of the active camera, for culling
+		CullStats octreeCull, boxCull;   // debug boxes drawn and culled last frame
 		TreeNode selectedNode;
 		glm::vec3 mouseDownPos, mouseLastPos;
 		bool bInDrag = false;
@@ -75,6 +82,14 @@ class ofApp : public ofBaseApp{
 		bool bReverse = false;
 		glm::vec3 landerLastPos;
 
+		/* Collision */
+		// contacts found this step, consumed by the passes below in order
+		vector<ContactEvent> contacts;
+		void detectCollisions();
+		void resolveContacts();
+		void applyContactEffects();
+		void updateContactHud();
+
 		/* GUI */
 		ofxIntSlider numLevels;
 		ofxPanel gui;
@@ -95,6 +110,13 @@ class ofApp : public ofBaseApp{
 		/* Timing */
 		ofxToggle timingToggle;
 		bool bTimingInfo = true;
+		char timingStr[512] = "";
+		char particleStr[512] = "";
+		uint64_t physicsMicros = 0;
+		uint64_t detectMicros = 0;
+		uint64_t resolveMicros = 0;
+		uint64_t effectsMicros = 0;
+		uint64_t hudMicros = 0;
 
 		// window dimensions
 		int windowWidth;
@@ -103,9 +125,25 @@ class ofApp : public ofBaseApp{
 		// player
 		Player player;
 
+		/* Vehicles */
+		// SoA physics state for every vehicle in the scene
+		VehicleBatch vehicles;
+		void integrateVehicles();
+
+		/* Particles */
+		// shared particle cap and time budget for every effect in the scene
+		ParticleBudget particleBudget;
+
+		/* Debris */
+		// rigid lander pieces thrown by a crash, instead of the particle
+		// explosion when the toggle is on
+		DebrisBatch debris;
+		ofxToggle debrisToggle;
+
 
 		/* Altitude */
 		bool bShowAltitude = true;
+		float altitude = -1;
 
 		/* Fonts */
 		ofTrueTypeFont font;
@@ -132,4 +170,12 @@ class ofApp : public ofBaseApp{
 
 		/* Score */
 		bool bShowScore = false;
+
+		/* Snapshot */
+		// checkpoint of the full simulation state for instant retry
+		SimSnapshot checkpoint;
+		void saveSnapshot(SimSnapshot &snap);
+		void restoreSnapshot(SimSnapshot &snap);
+		uint64_t snapshotSaveMicros = 0;
+		uint64_t snapshotRestoreMicros = 0;
 };